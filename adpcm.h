@@ -0,0 +1,380 @@
+/*
+ * IMA ADPCM and Microsoft ADPCM sample data, kept compressed where we can.
+ *
+ * Both store 4 bits per sample, a quarter of 16-bit PCM.  When the driver
+ * takes the format as is (AL_EXT_IMA4, AL_SOFT_MSADPCM, plus
+ * AL_SOFT_block_alignment for any block length but the default), the WAVE
+ * data chunk goes to alBufferData untouched and stays compressed in the
+ * buffer.  Otherwise whole sounds get decoded once at upload, and streams
+ * get decoded a block at a time as the queue asks for more.
+ *
+ * Decoding stays scalar:  each sample's predictor and step size depend on
+ * the sample before, so there is no run of independent lanes to vectorize
+ * short of decoding several blocks at once, and a block decodes in well
+ * under a microsecond anyway.
+ */
+#define MAX_ADPCM_COEFS 32
+
+static const ALshort IMA_steps[89] = {
+        7,     8,     9,    10,    11,    12,    13,    14,    16,    17,
+       19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+       50,    55,    60,    66,    73,    80,    88,    97,   107,   118,
+      130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+      337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+      876,   963,  1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+     2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+     5894,  6484,  7132,  7845,  8630,  9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+static const signed char IMA_index_steps[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static const ALshort MS_adaptation[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+    768, 614, 512, 409, 307, 230, 230, 230
+};
+static const ALshort MS_default_coefs[7][2] = {
+    { 256, 0 }, { 512, -256 }, { 0, 0 }, { 192, 64 },
+    { 240, 0 }, { 460, -208 }, { 392, -232 }
+};
+
+ALshort clamp_sample(ALint sample)
+{
+    if (sample > 32767)
+        return 32767;
+    if (sample < -32768)
+        return -32768;
+    return (ALshort)sample;
+}
+
+/*
+ * Each channel starts with a 4-byte header (first sample, step index), then
+ * the channels take turns with 4-byte words of 8 samples, low nibble first.
+ */
+void decode_IMA4_block(ALshort* dst, const ALubyte* src, ALsizei channels,
+    ALsizei block_frames)
+{
+    ALint sample[2], index[2];
+    register ALsizei i, c, k;
+
+    for (c = 0; c < channels; c++)
+    {
+        sample[c] = (ALshort)read_LE16(src + 4*c);
+        index[c] = (src[4*c + 2] > 88) ? 88 : src[4*c + 2];
+        dst[c] = (ALshort)sample[c];
+    }
+    src += 4 * channels;
+    for (i = 1; i < block_frames; i += 8)
+        for (c = 0; c < channels; c++)
+        {
+            for (k = 0; k < 8; k++)
+            {
+                const ALint nibble = (src[k >> 1] >> ((k & 1) << 2)) & 0xF;
+                const ALint step = IMA_steps[index[c]];
+                ALint diff = step >> 3;
+
+                if (nibble & 1)
+                    diff += step >> 2;
+                if (nibble & 2)
+                    diff += step >> 1;
+                if (nibble & 4)
+                    diff += step;
+                sample[c] = clamp_sample(
+                    (nibble & 8) ? sample[c] - diff : sample[c] + diff);
+                index[c] += IMA_index_steps[nibble & 7];
+                index[c] = (index[c] < 0) ? 0 : (index[c] > 88) ? 88 : index[c];
+                dst[(i + k)*channels + c] = (ALshort)sample[c];
+            }
+            src += 4;
+        }
+    return;
+}
+
+/*
+ * A 7-byte header per channel (predictor, delta, then the second and first
+ * samples), then one nibble per sample, high nibble first, the channels
+ * interleaved sample by sample.
+ */
+void decode_MSADPCM_block(ALshort* dst, const ALubyte* src, ALsizei channels,
+    ALsizei block_frames, const ALshort (*coefs)[2], ALsizei coef_count)
+{
+    ALint coef1[2], coef2[2], delta[2], s1[2], s2[2];
+    const ALsizei samples = block_frames * channels;
+    register ALsizei n, c;
+
+    for (c = 0; c < channels; c++)
+    {
+        const ALsizei predictor = (src[c] < coef_count) ? src[c] : 0;
+
+        coef1[c] = coefs[predictor][0];
+        coef2[c] = coefs[predictor][1];
+        delta[c] = (ALshort)read_LE16(src + channels + 2*c);
+        s1[c] = (ALshort)read_LE16(src + 3*channels + 2*c);
+        s2[c] = (ALshort)read_LE16(src + 5*channels + 2*c);
+        dst[c] = (ALshort)s2[c];
+        dst[channels + c] = (ALshort)s1[c];
+    }
+    src += 7 * channels;
+    for (n = 2*channels; n < samples; n++)
+    {
+        const ALsizei i = n - 2*channels;
+        const ALint nibble = (i & 1) ? (src[i >> 1] & 0xF) : (src[i >> 1] >> 4);
+        ALint predicted;
+
+        c = n & (channels - 1); /* 1 or 2 channels */
+        predicted = (s1[c]*coef1[c] + s2[c]*coef2[c]) >> 8;
+        predicted += ((nibble ^ 8) - 8) * delta[c]; /* signed nibble */
+        s2[c] = s1[c];
+        s1[c] = clamp_sample(predicted);
+        delta[c] = (MS_adaptation[nibble] * delta[c]) >> 8;
+        if (delta[c] < 16)
+            delta[c] = 16;
+        dst[n] = (ALshort)s1[c];
+    }
+    return;
+}
+
+/*
+ * Decodes any supported WAVE data a block at a time, for streaming or for
+ * decoding a whole sound up front.
+ */
+typedef struct {
+    const wave_file* wave;
+    ALshort coefs[MAX_ADPCM_COEFS][2]; /* MS ADPCM predictors */
+    ALsizei coef_count;
+    ALshort* decoded; /* one block */
+    ALsizei cursor; /* next frame of `decoded` to hand out */
+    ALsizei block; /* next block to decode */
+} adpcm_reader;
+
+ALboolean open_adpcm_reader(adpcm_reader* reader, const wave_file* wave)
+{
+    register ALsizei i;
+
+    memset(reader, 0, sizeof(adpcm_reader));
+    reader->wave = wave;
+    reader->cursor = wave->block_frames; /* as if a block were used up */
+    if (wave->format_tag == WAVE_FORMAT_ADPCM)
+    { /* The file may bring its own predictors; most bring the usual 7. */
+        reader->coef_count = (wave->extra_size >= 2)
+            ? read_LE16(wave->extra) : 0;
+        if (reader->coef_count > MAX_ADPCM_COEFS
+         || 2 + 4*reader->coef_count > wave->extra_size)
+            reader->coef_count = 0;
+        for (i = 0; i < reader->coef_count; i++)
+        {
+            reader->coefs[i][0] = (ALshort)read_LE16(wave->extra + 2 + 4*i);
+            reader->coefs[i][1] = (ALshort)read_LE16(wave->extra + 4 + 4*i);
+        }
+        if (reader->coef_count == 0)
+        {
+            memcpy(reader->coefs, MS_default_coefs, sizeof(MS_default_coefs));
+            reader->coef_count = 7;
+        }
+    }
+    reader->decoded = (ALshort *)pcm_alloc(
+        wave->block_frames * wave->channels * sizeof(ALshort));
+    if (reader->decoded == NULL)
+    {
+        printf("Failed to allocate ADPCM decoding memory.\n");
+        return AL_FALSE;
+    }
+    return AL_TRUE;
+}
+
+void close_adpcm_reader(adpcm_reader* reader)
+{
+    pcm_free(reader->decoded);
+    reader->decoded = NULL;
+    return;
+}
+
+void decode_adpcm_block(const adpcm_reader* reader, ALshort* dst,
+    ALsizei block)
+{
+    const wave_file* wave = reader->wave;
+    const ALubyte* src = wave->data + block * wave->block_align;
+
+    if (wave->format_tag == WAVE_FORMAT_IMA_ADPCM)
+        decode_IMA4_block(dst, src, wave->channels, wave->block_frames);
+    else
+        decode_MSADPCM_block(dst, src, wave->channels, wave->block_frames,
+            (const ALshort (*)[2])reader->coefs, reader->coef_count);
+    return;
+}
+
+/*
+ * stream_fill producing 16-bit PCM, looping back to the start at the end
+ * like fill_memory_loop.
+ */
+ALsizei fill_adpcm(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    adpcm_reader* reader = (adpcm_reader *)user;
+    const wave_file* wave = reader->wave;
+    const ALsizei frame_size = wave->channels * sizeof(ALshort);
+    const ALsizei blocks = wave->size / wave->block_align;
+    ALubyte* out = (ALubyte *)data;
+    ALsizei left = frames;
+
+    if (blocks == 0)
+        return 0;
+    while (left > 0)
+    {
+        ALsizei count = wave->block_frames - reader->cursor;
+
+        if (count == 0)
+        {
+            decode_adpcm_block(reader, reader->decoded, reader->block);
+            reader->block = (reader->block + 1) % blocks;
+            reader->cursor = 0;
+            count = wave->block_frames;
+        }
+        if (count > left)
+            count = left;
+        memcpy(out, reader->decoded + reader->cursor * wave->channels,
+            count * frame_size);
+        out += count * frame_size;
+        reader->cursor += count;
+        left -= count;
+    }
+    return (frames);
+}
+
+/*
+ * stream_peek flavour of the above:  hands out what is left of the current
+ * block in place, decoding the next one once it is used up.
+ */
+ALsizei peek_adpcm(ALvoid* user, const ALvoid** data, ALsizei frames)
+{
+    adpcm_reader* reader = (adpcm_reader *)user;
+    const wave_file* wave = reader->wave;
+    const ALsizei blocks = wave->size / wave->block_align;
+    ALsizei count;
+
+    if (blocks == 0)
+        return 0;
+    if (reader->cursor == wave->block_frames)
+    {
+        decode_adpcm_block(reader, reader->decoded, reader->block);
+        reader->block = (reader->block + 1) % blocks;
+        reader->cursor = 0;
+    }
+    count = wave->block_frames - reader->cursor;
+    if (count > frames)
+        count = frames;
+    *data = reader->decoded + reader->cursor * wave->channels;
+    reader->cursor += count;
+    return (count);
+}
+
+/*
+ * Carry on from sample frame `frame`.  Landing on a block boundary costs
+ * nothing; anywhere else decodes that block up front.
+ */
+void seek_adpcm(adpcm_reader* reader, ALsizei frame)
+{
+    const wave_file* wave = reader->wave;
+    const ALsizei blocks = wave->size / wave->block_align;
+
+    if (blocks == 0)
+        return;
+    reader->block = (frame / wave->block_frames) % blocks;
+    reader->cursor = wave->block_frames;
+    if (frame % wave->block_frames == 0)
+        return;
+    decode_adpcm_block(reader, reader->decoded, reader->block);
+    reader->block = (reader->block + 1) % blocks;
+    reader->cursor = frame % wave->block_frames;
+    return;
+}
+
+/*
+ * Can `wave` go to alBufferData without decoding?
+ */
+ALboolean can_upload_compressed(const wave_file* wave)
+{
+    ALboolean supported, default_alignment;
+
+    if (wave->format == wave->pcm_format)
+        return AL_FALSE;
+    if (wave->format_tag == WAVE_FORMAT_IMA_ADPCM)
+    {
+        supported = have_cap(CAP_EXT_IMA4);
+        default_alignment = (wave->block_frames == 65);
+    }
+    else
+    {
+        supported = have_cap(CAP_SOFT_MSADPCM);
+        default_alignment = (wave->block_frames == 64);
+    }
+    return supported && (default_alignment
+        || have_cap(CAP_SOFT_BLOCK_ALIGNMENT));
+}
+
+/*
+ * Bytes the buffer will hold after upload_wave().
+ */
+ALsizei wave_upload_size(const wave_file* wave, ALboolean as_float)
+{
+    if (can_upload_compressed(wave))
+        return (wave->size);
+    return wave->frames * format_frame_size(
+        as_float ? float_format(wave->pcm_format) : wave->pcm_format);
+}
+
+/*
+ * Upload the whole of `wave` to `buf`:  compressed if the driver allows,
+ * otherwise as PCM (or floats, with `as_float`).  Errors are left for the
+ * caller's alGetError(); AL_FALSE means we ran out of memory first.
+ */
+ALboolean upload_wave(ALuint buf, const wave_file* wave, ALboolean as_float)
+{
+    const ALenum format = as_float
+        ? float_format(wave->pcm_format) : wave->pcm_format;
+    adpcm_reader reader;
+    const ALvoid* pcm = wave->data;
+    ALshort* decoded = NULL;
+    ALvoid* scratch = NULL;
+    register ALsizei i;
+
+    if (can_upload_compressed(wave))
+    {
+        if (have_cap(CAP_SOFT_BLOCK_ALIGNMENT))
+            alBufferi(buf, AL_UNPACK_BLOCK_ALIGNMENT_SOFT, wave->block_frames);
+        alBufferData(buf, wave->format, wave->data, wave->size,
+            wave->frequency);
+        return AL_TRUE;
+    }
+    if (wave->format != wave->pcm_format)
+    {
+        if (open_adpcm_reader(&reader, wave) == AL_FALSE)
+            return AL_FALSE;
+        decoded = (ALshort *)malloc(
+            wave->frames * wave->channels * sizeof(ALshort));
+        if (decoded == NULL)
+        {
+            printf("Failed to allocate ADPCM decoding memory.\n");
+            close_adpcm_reader(&reader);
+            return AL_FALSE;
+        }
+        for (i = 0; i < wave->size / wave->block_align; i++)
+            decode_adpcm_block(&reader,
+                decoded + i * wave->block_frames * wave->channels, i);
+        close_adpcm_reader(&reader);
+        pcm = decoded;
+    }
+    if (format != wave->pcm_format)
+    {
+        scratch = malloc(wave->frames * format_frame_size(format));
+        if (scratch == NULL)
+        {
+            printf("Failed to allocate sample conversion memory.\n");
+            free(decoded);
+            return AL_FALSE;
+        }
+    }
+    convert_buffer_data(buf, format, pcm, wave->pcm_format, 0, wave->frames,
+        wave->frequency, scratch);
+    free(scratch);
+    free(decoded);
+    return AL_TRUE;
+}
@@ -0,0 +1,271 @@
+/*
+ * Fixed-size blocks of PCM staging memory from one preallocated arena.
+ *
+ * Every staging area on the streaming path is at most one AL buffer of
+ * sample frames at the widest frame there is (stereo float), so one block
+ * size fits them all:  blocks never fragment, and any free block will do.
+ * The arena is a single VirtualAlloc(), on large pages (MEM_LARGE_PAGES)
+ * where the account may lock memory (SeLockMemoryPrivilege, enabled in the
+ * process token first), else on ordinary pages which get touched once up
+ * front, so no refill ever stops on a page fault.  Blocks are BLOCK_ALIGN
+ * bytes apart:  whole cache lines, and whole AVX2 vectors.
+ *
+ * Each thread keeps up to ARENA_CACHE free blocks of its own.  The arena's
+ * lock is only taken when that runs out or overflows, and then to move half
+ * of them at once.  After open_block_arena(), nothing here calls malloc().
+ *
+ * pcm_alloc() and pcm_free() take from `pcm_arena` whenever it is open and
+ * the size fits in a block, and fall back on malloc() and free() otherwise,
+ * so callers need not care which one they got.
+ */
+#define BLOCK_ALIGN     64
+#define ARENA_CACHE     8 /* free blocks kept back by each thread */
+#define ARENA_BLOCKS    64
+
+typedef struct {
+    ALubyte* base;
+    SIZE_T size; /* bytes reserved at `base` */
+    ALsizei block_size;
+    ALsizei count;
+    ALboolean large_pages;
+    LONG serial; /* tells apart arenas opened at the same address */
+
+    CRITICAL_SECTION lock;
+    ALubyte* free_head; /* Free blocks link through their first bytes. */
+    ALsizei free_count;
+
+    volatile LONG in_use;
+    volatile LONG peak;
+    volatile LONG refills; /* trips to the shared list to fill a cache */
+    volatile LONG misses; /* requests the arena had no block left for */
+} block_arena;
+
+/*
+ * A thread caches blocks of one arena at a time.
+ */
+typedef struct {
+    const block_arena* arena;
+    LONG serial;
+    ALubyte* blocks[ARENA_CACHE];
+    ALsizei count;
+} arena_cache;
+
+static THREAD_LOCAL arena_cache thread_blocks;
+static LONG arena_serials;
+
+block_arena pcm_arena;
+
+/*
+ * Enable SeLockMemoryPrivilege, which MEM_LARGE_PAGES requires, if the
+ * account was granted it ("Lock pages in memory").
+ */
+ALboolean enable_lock_memory(void)
+{
+    TOKEN_PRIVILEGES privileges;
+    HANDLE token;
+    ALboolean enabled;
+
+    if (OpenProcessToken(GetCurrentProcess(),
+            TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token) == 0)
+        return AL_FALSE;
+    privileges.PrivilegeCount = 1;
+    privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+            &privileges.Privileges[0].Luid)
+        && AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+        && GetLastError() == ERROR_SUCCESS; /* not ERROR_NOT_ALL_ASSIGNED */
+    CloseHandle(token);
+    return (enabled);
+}
+
+ALboolean open_block_arena(block_arena* arena, ALsizei block_size,
+    ALsizei count)
+{
+    const SIZE_T large = GetLargePageMinimum();
+    register ALsizei i;
+
+    memset(arena, 0, sizeof(block_arena));
+    block_size = (block_size + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+    if (block_size <= 0 || count <= 0)
+        return AL_FALSE;
+    arena->size = (SIZE_T)block_size * count;
+    if (large != 0 && enable_lock_memory())
+    {
+        const SIZE_T rounded = (arena->size + large - 1) & ~(large - 1);
+
+        arena->base = (ALubyte *)VirtualAlloc(NULL, rounded,
+            MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (arena->base != NULL)
+        {
+            arena->size = rounded;
+            arena->large_pages = AL_TRUE;
+        }
+    }
+    if (arena->base == NULL)
+    {
+        arena->base = (ALubyte *)VirtualAlloc(NULL, arena->size,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (arena->base == NULL)
+        {
+            printf("Failed to reserve %u bytes of PCM blocks.\n",
+                (unsigned int)arena->size);
+            return AL_FALSE;
+        }
+        memset(arena->base, 0, arena->size); /* Fault every page in now. */
+    }
+    arena->block_size = block_size;
+    arena->count = count;
+    arena->serial = InterlockedIncrement(&arena_serials);
+    InitializeCriticalSection(&arena->lock);
+    for (i = count - 1; i >= 0; i--)
+    {
+        ALubyte* block = arena->base + (SIZE_T)i * block_size;
+
+        *(ALubyte **)block = arena->free_head;
+        arena->free_head = block;
+    }
+    arena->free_count = count;
+    return AL_TRUE;
+}
+
+/*
+ * Once every thread having used the arena is done with it.
+ */
+void close_block_arena(block_arena* arena)
+{
+    if (arena->base == NULL)
+        return;
+    DeleteCriticalSection(&arena->lock);
+    VirtualFree(arena->base, 0, MEM_RELEASE);
+    memset(arena, 0, sizeof(block_arena));
+    return;
+}
+
+ALboolean in_block_arena(const block_arena* arena, const ALvoid* p)
+{
+    const ALubyte* at = (const ALubyte *)p;
+
+    return (arena->base != NULL
+         && at >= arena->base && at < arena->base + arena->size);
+}
+
+/*
+ * the calling thread's cache, emptied if it held blocks of an older arena
+ */
+arena_cache* own_cache(const block_arena* arena)
+{
+    arena_cache* cache = &thread_blocks;
+
+    if (cache->arena != arena || cache->serial != arena->serial)
+    {
+        cache->arena = arena;
+        cache->serial = arena->serial;
+        cache->count = 0;
+    }
+    return (cache);
+}
+
+/*
+ * Returns NULL, counting a miss, once every block is out.
+ */
+ALvoid* alloc_block(block_arena* arena)
+{
+    arena_cache* cache = own_cache(arena);
+    LONG in_use, peak;
+
+    if (cache->count == 0)
+    {
+        EnterCriticalSection(&arena->lock);
+        while (cache->count < ARENA_CACHE / 2 && arena->free_head != NULL)
+        {
+            cache->blocks[cache->count++] = arena->free_head;
+            arena->free_head = *(ALubyte **)arena->free_head;
+            --arena->free_count;
+        }
+        LeaveCriticalSection(&arena->lock);
+        if (cache->count == 0)
+        {
+            InterlockedIncrement(&arena->misses);
+            return NULL;
+        }
+        InterlockedIncrement(&arena->refills);
+    }
+    in_use = InterlockedIncrement(&arena->in_use);
+    do
+        peak = arena->peak;
+    while (in_use > peak
+        && InterlockedCompareExchange(&arena->peak, in_use, peak) != peak);
+    return (cache->blocks[--cache->count]);
+}
+
+/*
+ * Hand the calling thread's cached blocks back to the arena, as threads
+ * should before they exit.
+ */
+void flush_block_cache(block_arena* arena)
+{
+    arena_cache* cache = own_cache(arena);
+
+    if (arena->base == NULL || cache->count == 0)
+        return;
+    EnterCriticalSection(&arena->lock);
+    while (cache->count > 0)
+    {
+        ALubyte* block = cache->blocks[--cache->count];
+
+        *(ALubyte **)block = arena->free_head;
+        arena->free_head = block;
+        ++arena->free_count;
+    }
+    LeaveCriticalSection(&arena->lock);
+    return;
+}
+
+void free_block(block_arena* arena, ALvoid* block)
+{
+    arena_cache* cache = own_cache(arena);
+
+    if (cache->count == ARENA_CACHE)
+    {
+        EnterCriticalSection(&arena->lock);
+        while (cache->count > ARENA_CACHE / 2)
+        {
+            ALubyte* spare = cache->blocks[--cache->count];
+
+            *(ALubyte **)spare = arena->free_head;
+            arena->free_head = spare;
+            ++arena->free_count;
+        }
+        LeaveCriticalSection(&arena->lock);
+    }
+    cache->blocks[cache->count++] = (ALubyte *)block;
+    InterlockedDecrement(&arena->in_use);
+    return;
+}
+
+ALvoid* pcm_alloc(ALsizei size)
+{
+    ALvoid* block = NULL;
+
+    if (pcm_arena.base != NULL && size <= pcm_arena.block_size)
+        block = alloc_block(&pcm_arena);
+    return (block != NULL) ? block : malloc(size);
+}
+
+void pcm_free(ALvoid* p)
+{
+    if (in_block_arena(&pcm_arena, p))
+        free_block(&pcm_arena, p);
+    else
+        free(p);
+    return;
+}
+
+void log_block_arena(const block_arena* arena)
+{
+    printf("PCM arena:  %i blocks of %i bytes on %s pages, %i in use at "
+        "most, %i cache refills, %i misses\n", arena->count,
+        arena->block_size, arena->large_pages ? "large" : "small",
+        (int)arena->peak, (int)arena->refills, (int)arena->misses);
+    return;
+}
@@ -0,0 +1,332 @@
+/*
+ * Batched source and listener updates.
+ *
+ * Every alSource* or alListener* call may take the context lock and make
+ * the mixer recompute that object's panning and filter parameters.  Instead
+ * of issuing each change as it is made, callers record it in a shadow copy
+ * of the object's state; a change to the value already recorded is dropped
+ * on the spot.  commit_updates() then issues only the changed values, once
+ * per frame, inside one AL_SOFT_deferred_updates batch so the mixer sees
+ * them all at once and recomputes each object only once.
+ *
+ * Without AL_SOFT_deferred_updates the batch is bracketed by
+ * alcSuspendContext/alcProcessContext, which is the OpenAL 1.1 way to say
+ * the same thing, though many implementations treat it as a no-op.
+ */
+#define MAX_BATCH       (MAX_VOICES + NUM_SOURCES)
+
+#define DIRTY_POSITION  0x0001
+#define DIRTY_VELOCITY  0x0002
+#define DIRTY_DIRECTION 0x0004
+#define DIRTY_GAIN      0x0008
+#define DIRTY_PITCH     0x0010
+#define DIRTY_ORIENTATION 0x0020
+
+typedef struct {
+    ALuint name;
+    ALuint dirty;
+    ALboolean queued; /* in the batch's list of dirty sources */
+
+    ALfloat position[3];
+    ALfloat velocity[3];
+    ALfloat direction[3];
+    ALfloat gain;
+    ALfloat pitch;
+} source_shadow;
+
+typedef struct {
+    ALuint dirty;
+
+    ALfloat position[3];
+    ALfloat velocity[3];
+    ALfloat orientation[6]; /* "at" vector, then "up" */
+    ALfloat gain;
+} listener_shadow;
+
+typedef struct {
+    listener_shadow listener;
+    source_shadow* dirty[MAX_BATCH];
+    ALsizei dirty_count;
+
+    ALuint calls; /* AL calls actually issued */
+    ALuint skipped; /* changes dropped as no change at all */
+    ALuint commits;
+} update_batch;
+
+LPALDEFERUPDATESSOFT alDeferUpdatesSOFT;
+LPALPROCESSUPDATESSOFT alProcessUpdatesSOFT;
+static THREAD_LOCAL int defer_depth; /* per thread, as contexts may be */
+
+update_batch updates;
+source_shadow source_state; /* of the tester's own `source` */
+
+void load_deferred_updates(void)
+{
+    alDeferUpdatesSOFT = NULL;
+    alProcessUpdatesSOFT = NULL;
+    if (have_cap(CAP_SOFT_DEFERRED_UPDATES) == AL_FALSE)
+    {
+        printf("Failed to detect extension:  %s.\n",
+            "AL_SOFT_deferred_updates");
+        return;
+    }
+    alDeferUpdatesSOFT = (LPALDEFERUPDATESSOFT)
+        alGetProcAddress("alDeferUpdatesSOFT");
+    alProcessUpdatesSOFT = (LPALPROCESSUPDATESSOFT)
+        alGetProcAddress("alProcessUpdatesSOFT");
+    if (alDeferUpdatesSOFT == NULL || alProcessUpdatesSOFT == NULL)
+        alDeferUpdatesSOFT = NULL;
+    return;
+}
+
+/*
+ * Hold back everything the mixer would see until the matching
+ * end_updates().  Pairs may nest; only the outermost one counts.
+ */
+void begin_updates(void)
+{
+    if (defer_depth++ != 0)
+        return;
+    if (alDeferUpdatesSOFT != NULL)
+        alDeferUpdatesSOFT();
+    else
+        alcSuspendContext(alcGetCurrentContext());
+    return;
+}
+
+void end_updates(void)
+{
+    if (--defer_depth != 0)
+        return;
+    if (alDeferUpdatesSOFT != NULL)
+        alProcessUpdatesSOFT();
+    else
+        alcProcessContext(alcGetCurrentContext());
+    return;
+}
+
+/*
+ * The shadows start out as a copy of what AL already holds, so the first
+ * change that matters is never mistaken for no change.
+ */
+void init_source_shadow(source_shadow* shadow, ALuint name)
+{
+    memset(shadow, 0, sizeof(source_shadow));
+    shadow->name = name;
+    alGetSourcefv(name, AL_POSITION, shadow->position);
+    alGetSourcefv(name, AL_VELOCITY, shadow->velocity);
+    alGetSourcefv(name, AL_DIRECTION, shadow->direction);
+    alGetSourcef(name, AL_GAIN, &shadow->gain);
+    alGetSourcef(name, AL_PITCH, &shadow->pitch);
+    return;
+}
+
+void init_update_batch(update_batch* batch)
+{
+    memset(batch, 0, sizeof(update_batch));
+    alGetListenerfv(AL_POSITION, batch->listener.position);
+    alGetListenerfv(AL_VELOCITY, batch->listener.velocity);
+    alGetListenerfv(AL_ORIENTATION, batch->listener.orientation);
+    alGetListenerf(AL_GAIN, &batch->listener.gain);
+    return;
+}
+
+/*
+ * Store `count` floats into a shadow field, returning AL_FALSE (and
+ * counting the skip) if they are what the field already holds.
+ */
+ALboolean shadow_store(update_batch* batch, ALfloat* field,
+    const ALfloat* values, ALsizei count)
+{
+    if (memcmp(field, values, count * sizeof(ALfloat)) == 0)
+    {
+        ++batch->skipped;
+        return AL_FALSE;
+    }
+    memcpy(field, values, count * sizeof(ALfloat));
+    return AL_TRUE;
+}
+
+void commit_updates(update_batch* batch);
+void mark_source(update_batch* batch, source_shadow* shadow, ALuint bit)
+{
+    if (!shadow->queued && batch->dirty_count >= MAX_BATCH)
+        commit_updates(batch); /* Flush early rather than lose a change. */
+    shadow->dirty |= bit;
+    if (shadow->queued)
+        return;
+    shadow->queued = AL_TRUE;
+    batch->dirty[batch->dirty_count++] = shadow;
+    return;
+}
+
+void batch_sourcefv(update_batch* batch, source_shadow* shadow,
+    ALenum param, const ALfloat* values)
+{
+    switch (param)
+    {
+    case AL_POSITION:
+        if (shadow_store(batch, shadow->position, values, 3))
+            mark_source(batch, shadow, DIRTY_POSITION);
+        return;
+    case AL_VELOCITY:
+        if (shadow_store(batch, shadow->velocity, values, 3))
+            mark_source(batch, shadow, DIRTY_VELOCITY);
+        return;
+    case AL_DIRECTION:
+        if (shadow_store(batch, shadow->direction, values, 3))
+            mark_source(batch, shadow, DIRTY_DIRECTION);
+        return;
+    case AL_GAIN:
+        if (shadow_store(batch, &shadow->gain, values, 1))
+            mark_source(batch, shadow, DIRTY_GAIN);
+        return;
+    case AL_PITCH:
+        if (shadow_store(batch, &shadow->pitch, values, 1))
+            mark_source(batch, shadow, DIRTY_PITCH);
+        return;
+    default: /* not shadowed:  straight through */
+        alSourcefv(shadow->name, param, values);
+        ++batch->calls;
+    }
+    return;
+}
+
+void batch_sourcef(update_batch* batch, source_shadow* shadow,
+    ALenum param, ALfloat value)
+{
+    batch_sourcefv(batch, shadow, param, &value);
+    return;
+}
+
+void batch_source3f(update_batch* batch, source_shadow* shadow,
+    ALenum param, ALfloat x, ALfloat y, ALfloat z)
+{
+    ALfloat values[3];
+
+    values[0] = x;
+    values[1] = y;
+    values[2] = z;
+    batch_sourcefv(batch, shadow, param, values);
+    return;
+}
+
+void batch_listenerfv(update_batch* batch, ALenum param,
+    const ALfloat* values)
+{
+    listener_shadow* listener = &batch->listener;
+
+    switch (param)
+    {
+    case AL_POSITION:
+        if (shadow_store(batch, listener->position, values, 3))
+            listener->dirty |= DIRTY_POSITION;
+        return;
+    case AL_VELOCITY:
+        if (shadow_store(batch, listener->velocity, values, 3))
+            listener->dirty |= DIRTY_VELOCITY;
+        return;
+    case AL_ORIENTATION:
+        if (shadow_store(batch, listener->orientation, values, 6))
+            listener->dirty |= DIRTY_ORIENTATION;
+        return;
+    case AL_GAIN:
+        if (shadow_store(batch, &listener->gain, values, 1))
+            listener->dirty |= DIRTY_GAIN;
+        return;
+    default:
+        alListenerfv(param, values);
+        ++batch->calls;
+    }
+    return;
+}
+
+void batch_listenerf(update_batch* batch, ALenum param, ALfloat value)
+{
+    batch_listenerfv(batch, param, &value);
+    return;
+}
+
+ALuint dirty_count(ALuint dirty)
+{
+    ALuint count = 0;
+
+    for (; dirty != 0; dirty &= dirty - 1)
+        ++count;
+    return (count);
+}
+
+/*
+ * Issue every recorded change in one deferred batch, then forget them.
+ * Meant to be called once per frame of the application.
+ */
+void commit_updates(update_batch* batch)
+{
+    listener_shadow* listener = &batch->listener;
+    register ALsizei i;
+
+    if (batch->dirty_count == 0 && listener->dirty == 0)
+        return;
+    begin_updates();
+    batch->calls += dirty_count(listener->dirty);
+    if (listener->dirty & DIRTY_POSITION)
+        alListenerfv(AL_POSITION, listener->position);
+    if (listener->dirty & DIRTY_VELOCITY)
+        alListenerfv(AL_VELOCITY, listener->velocity);
+    if (listener->dirty & DIRTY_ORIENTATION)
+        alListenerfv(AL_ORIENTATION, listener->orientation);
+    if (listener->dirty & DIRTY_GAIN)
+        alListenerf(AL_GAIN, listener->gain);
+    listener->dirty = 0;
+
+    for (i = 0; i < batch->dirty_count; i++)
+    {
+        source_shadow* shadow = batch->dirty[i];
+        const ALuint src = shadow->name;
+
+        batch->calls += dirty_count(shadow->dirty);
+        if (shadow->dirty & DIRTY_POSITION)
+            alSourcefv(src, AL_POSITION, shadow->position);
+        if (shadow->dirty & DIRTY_VELOCITY)
+            alSourcefv(src, AL_VELOCITY, shadow->velocity);
+        if (shadow->dirty & DIRTY_DIRECTION)
+            alSourcefv(src, AL_DIRECTION, shadow->direction);
+        if (shadow->dirty & DIRTY_GAIN)
+            alSourcef(src, AL_GAIN, shadow->gain);
+        if (shadow->dirty & DIRTY_PITCH)
+            alSourcef(src, AL_PITCH, shadow->pitch);
+        shadow->dirty = 0;
+        shadow->queued = AL_FALSE;
+    }
+    batch->dirty_count = 0;
+    end_updates();
+    ++batch->commits;
+    return;
+}
+
+void change_volume(ALfloat gain)
+{
+/*
+ * Experimental volume changer.
+ * OpenAL 1.1 specifications standardize the range 0.0 <= gain <= 1.0.
+ * 0.0 is the way to mute and possibly even disable sound processing latency.
+ * 1.0 could be the maximum volume ratio.  Some implementations allow higher.
+ */
+#if (0)
+    alSourcef(source, AL_MIN_GAIN, 0.0F); /* can't have negative gains anyway */
+    alSourcef(source, AL_MAX_GAIN, gain); /* uncertain ... allow gains > 1.0? */
+#endif
+    batch_listenerf(&updates, AL_GAIN, gain);
+    batch_sourcef(&updates, &source_state, AL_GAIN, gain); /* overruled */
+    commit_updates(&updates);
+    return;
+}
+
+void log_update_batch(const update_batch* batch)
+{
+    printf("Batched updates:  %u AL calls in %u commits, %u skipped (%s)\n",
+        batch->calls, batch->commits, batch->skipped,
+        alDeferUpdatesSOFT != NULL
+      ? "AL_SOFT_deferred_updates" : "alcSuspendContext");
+    return;
+}
@@ -0,0 +1,321 @@
+/*
+ * Headless mixer benchmark over an ALC_SOFT_loopback device.
+ *
+ * A loopback device has no sound card behind it:  the mixer runs only when
+ * alcRenderSamplesSOFT asks it to, so it goes as fast as the CPU allows and
+ * needs no speakers, which makes it usable on a build server.
+ *
+ * Every combination of source count, update size (frames mixed per render
+ * call, the loopback stand-in for the device period), buffer format and
+ * pitch gets its own context, set up by the same initialize_listener() and
+ * setup_source() the interactive tester uses, then timed while rendering
+ * BENCH_SECONDS of audio.  Results go to the screen and to BENCHMRK.CSV.
+ */
+#define BENCH_RATE      44100
+#define BENCH_SECONDS   2
+#define BENCH_TONE      4410 /* sample frames in each looping test tone */
+#define BENCH_PERIOD    98 /* frames per cycle, 45 to a tone:  450 Hz */
+
+LPALCLOOPBACKOPENDEVICESOFT alcLoopbackOpenDeviceSOFT;
+LPALCISRENDERFORMATSUPPORTEDSOFT alcIsRenderFormatSupportedSOFT;
+LPALCRENDERSAMPLESSOFT alcRenderSamplesSOFT;
+PFNALCSETTHREADCONTEXTPROC alcSetThreadContext;
+PFNALCGETTHREADCONTEXTPROC alcGetThreadContext;
+
+/*
+ * high-resolution wall clock, in seconds
+ */
+ALdouble seconds_now(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (ALdouble)now.QuadPart / (ALdouble)frequency.QuadPart;
+}
+
+ALboolean load_loopback_functions(void)
+{
+    if (alcIsExtensionPresent(NULL, "ALC_SOFT_loopback") == ALC_FALSE)
+    {
+        printf("Failed to detect extension:  %s.\n", "ALC_SOFT_loopback");
+        return AL_FALSE;
+    }
+    alcLoopbackOpenDeviceSOFT = (LPALCLOOPBACKOPENDEVICESOFT)
+        alcGetProcAddress(NULL, "alcLoopbackOpenDeviceSOFT");
+    alcIsRenderFormatSupportedSOFT = (LPALCISRENDERFORMATSUPPORTEDSOFT)
+        alcGetProcAddress(NULL, "alcIsRenderFormatSupportedSOFT");
+    alcRenderSamplesSOFT = (LPALCRENDERSAMPLESSOFT)
+        alcGetProcAddress(NULL, "alcRenderSamplesSOFT");
+    if (alcIsExtensionPresent(NULL, "ALC_EXT_thread_local_context"))
+    {
+        alcSetThreadContext = (PFNALCSETTHREADCONTEXTPROC)
+            alcGetProcAddress(NULL, "alcSetThreadContext");
+        alcGetThreadContext = (PFNALCGETTHREADCONTEXTPROC)
+            alcGetProcAddress(NULL, "alcGetThreadContext");
+        if (alcGetThreadContext == NULL)
+            alcSetThreadContext = NULL;
+    }
+    return (alcLoopbackOpenDeviceSOFT != NULL
+         && alcIsRenderFormatSupportedSOFT != NULL
+         && alcRenderSamplesSOFT != NULL);
+}
+
+/*
+ * Make `context` current for the calling thread alone where the driver has
+ * ALC_EXT_thread_local_context, so threads driving contexts of their own
+ * never switch one another's away; else for the whole process.
+ */
+ALCboolean bind_context(ALCcontext* context)
+{
+    if (alcSetThreadContext != NULL)
+        return alcSetThreadContext(context);
+    return alcMakeContextCurrent(context);
+}
+
+/*
+ * Open a loopback device mixing 16-bit stereo at `rate`, with a context
+ * allowing `voices` simultaneous sources bound to the calling thread.
+ */
+ALCcontext* open_loopback_context(ALCdevice** device, ALCint rate,
+    ALCint voices)
+{
+    ALCcontext* context;
+    ALCint attributes[] = {
+        ALC_FREQUENCY, 0,
+        ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT,
+        ALC_FORMAT_TYPE_SOFT, ALC_SHORT_SOFT,
+        ALC_MONO_SOURCES, 0,
+        ALC_STEREO_SOURCES, 0,
+        ALC_INVALID, ALC_INVALID
+    };
+
+    attributes[1] = rate;
+    attributes[7] = attributes[9] = voices;
+    *device = alcLoopbackOpenDeviceSOFT(NULL);
+    if (*device == NULL)
+    {
+        printf("Unable to open a loopback device.\n");
+        return NULL;
+    }
+    if (alcIsRenderFormatSupportedSOFT(*device, rate, ALC_STEREO_SOFT,
+            ALC_SHORT_SOFT) == ALC_FALSE)
+    {
+        printf("Loopback device cannot render 16-bit stereo.\n");
+        alcCloseDevice(*device);
+        return NULL;
+    }
+    context = alcCreateContext(*device, attributes);
+    if (context == NULL || bind_context(context) == ALC_FALSE)
+    {
+        printf("Failed to initialize loopback AL.\n");
+        if (context != NULL)
+            alcDestroyContext(context);
+        alcCloseDevice(*device);
+        return NULL;
+    }
+    return (context);
+}
+
+void close_loopback_context(ALCdevice* device, ALCcontext* context)
+{
+    bind_context(NULL);
+    alcDestroyContext(context);
+    alcCloseDevice(device);
+    return;
+}
+
+/*
+ * Fill an AL buffer with a 450 Hz sine tone, looping seamlessly as long as
+ * `frames` is a whole number of cycles (as BENCH_TONE is), so the loop
+ * point is no discontinuity for the resampler to interpolate across.
+ */
+ALboolean upload_test_tone(ALuint buf, ALenum format, ALsizei frames)
+{
+    const ALsizei channels = format_channels(format);
+    const ALsizei size = frames * format_frame_size(format);
+    ALubyte* data;
+    register ALsizei i, c;
+
+    data = (ALubyte *)malloc(size);
+    if (data == NULL)
+        return AL_FALSE;
+    for (i = 0; i < frames; i++)
+    {
+        const ALdouble v = 0.5 * sin(2 * 3.14159265358979323846 * i
+            / BENCH_PERIOD);
+
+        for (c = 0; c < channels; c++)
+            switch (format)
+            {
+                case AL_FORMAT_MONO8:
+                case AL_FORMAT_STEREO8:
+                    data[i*channels + c] = (ALubyte)(128 + 127*v);
+                    break;
+                case AL_FORMAT_MONO_FLOAT32:
+                case AL_FORMAT_STEREO_FLOAT32:
+                    ((ALfloat *)data)[i*channels + c] = (ALfloat)v;
+                    break;
+                default:
+                    ((ALshort *)data)[i*channels + c] = (ALshort)(32767*v);
+            }
+    }
+    alBufferData(buf, format, data, size, BENCH_RATE);
+    free(data);
+    return (alGetError() == AL_NO_ERROR);
+}
+
+typedef struct {
+    ALsizei sources;
+    ALsizei update; /* frames per alcRenderSamplesSOFT call */
+    ALenum format;
+    const char* format_name;
+    ALfloat pitch;
+
+    ALsizei frames; /* rendered in total */
+    ALdouble seconds;
+} bench_case;
+
+/*
+ * Set up one case on a fresh loopback context and time the mixer alone.
+ */
+ALboolean run_bench_case(bench_case* test)
+{
+    ALCdevice* device;
+    ALCcontext* context;
+    ALuint* sources;
+    ALuint tone;
+    ALshort* output;
+    ALdouble start;
+    register ALsizei i;
+
+    context = open_loopback_context(&device, BENCH_RATE, test->sources);
+    if (context == NULL)
+        return AL_FALSE;
+    sources = (ALuint *)malloc(test->sources * sizeof(ALuint));
+    output = (ALshort *)malloc(test->update * 2 * sizeof(ALshort));
+    if (sources == NULL || output == NULL)
+    {
+        free(sources);
+        free(output);
+        close_loopback_context(device, context);
+        return AL_FALSE;
+    }
+
+    initialize_listener();
+    alGenBuffers(1, &tone);
+    alGenSources(test->sources, sources);
+    if (alGetError() != AL_NO_ERROR || !upload_test_tone(tone, test->format,
+            BENCH_TONE))
+    {
+        printf("Could not set up %i sources of %s.\n",
+            test->sources, test->format_name);
+        free(sources);
+        free(output);
+        close_loopback_context(device, context);
+        return AL_FALSE;
+    }
+    begin_updates();
+    for (i = 0; i < test->sources; i++)
+    { /* Spread sources around the listener so mono ones get panned. */
+        const ALdouble angle = 2 * 3.14159265358979323846 * i / test->sources;
+
+        setup_source(sources[i]);
+        alSource3f(sources[i], AL_POSITION,
+            (ALfloat)sin(angle), 0.0F, -(ALfloat)cos(angle));
+        alSourcef(sources[i], AL_PITCH, test->pitch);
+        alSourcei(sources[i], AL_LOOPING, AL_TRUE);
+        alSourcei(sources[i], AL_BUFFER, tone);
+    }
+    end_updates();
+    alSourcePlayv(test->sources, sources);
+    alcRenderSamplesSOFT(device, output, test->update); /* warm-up */
+
+    test->frames = 0;
+    start = seconds_now();
+    while (test->frames < BENCH_SECONDS * BENCH_RATE)
+    {
+        alcRenderSamplesSOFT(device, output, test->update);
+        test->frames += test->update;
+    }
+    test->seconds = seconds_now() - start;
+
+    alSourceStopv(test->sources, sources);
+    alDeleteSources(test->sources, sources);
+    alDeleteBuffers(1, &tone);
+    free(sources);
+    free(output);
+    close_loopback_context(device, context);
+    return AL_TRUE;
+}
+
+int run_benchmarks(void)
+{
+    static const ALsizei source_counts[] = { 1, 8, 32, 128 };
+    static const ALsizei update_sizes[] = { 256, 1024, BUFFER_SIZE };
+    static const ALfloat pitches[] = { 1.0F, 0.75F, 1.5F };
+    static const ALenum formats[] = {
+        AL_FORMAT_MONO8, AL_FORMAT_MONO16, AL_FORMAT_STEREO16,
+        AL_FORMAT_MONO_FLOAT32
+    };
+    static const char* format_names[] = {
+        "mono8", "mono16", "stereo16", "mono_float32"
+    };
+    FILE* out;
+    bench_case test;
+    ALboolean have_float;
+    register int s, u, f, p;
+
+    if (load_loopback_functions() == AL_FALSE)
+        return 1;
+    out = fopen("BENCHMRK.CSV", "w");
+    if (out == NULL)
+    {
+        printf("Unable to write BENCHMRK.CSV.\n");
+        return 1;
+    }
+    fprintf(out, "sources,update_frames,format,pitch,frames,seconds,"
+        "frames_per_sec,realtime_factor,ns_per_frame,ns_per_source_frame\n");
+    printf("%7s %6s %-13s %5s %12s %9s %10s %10s\n", "sources", "update",
+        "format", "pitch", "frames/s", "realtime", "ns/frame", "ns/source");
+
+    have_float = AL_TRUE; /* until an AL_FORMAT_MONO_FLOAT32 upload fails */
+    for (f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++)
+    for (s = 0; s < (int)(sizeof(source_counts) / sizeof(ALsizei)); s++)
+    for (u = 0; u < (int)(sizeof(update_sizes) / sizeof(ALsizei)); u++)
+    for (p = 0; p < (int)(sizeof(pitches) / sizeof(ALfloat)); p++)
+    {
+        ALdouble ns_frame;
+
+        if (formats[f] == AL_FORMAT_MONO_FLOAT32 && !have_float)
+            continue;
+        test.sources = source_counts[s];
+        test.update = update_sizes[u];
+        test.format = formats[f];
+        test.format_name = format_names[f];
+        test.pitch = pitches[p];
+        if (run_bench_case(&test) == AL_FALSE)
+        {
+            if (formats[f] == AL_FORMAT_MONO_FLOAT32)
+                have_float = AL_FALSE; /* no AL_EXT_FLOAT32; skip the rest */
+            continue;
+        }
+
+        ns_frame = 1e9 * test.seconds / test.frames;
+        printf("%7i %6i %-13s %5.2f %12.0f %8.1fx %10.1f %10.2f\n",
+            test.sources, test.update, test.format_name, test.pitch,
+            test.frames / test.seconds,
+            test.frames / (test.seconds * BENCH_RATE),
+            ns_frame, ns_frame / test.sources);
+        fprintf(out, "%i,%i,%s,%.2f,%i,%.6f,%.0f,%.2f,%.2f,%.3f\n",
+            test.sources, test.update, test.format_name, test.pitch,
+            test.frames, test.seconds, test.frames / test.seconds,
+            test.frames / (test.seconds * BENCH_RATE),
+            ns_frame, ns_frame / test.sources);
+        fflush(out);
+    }
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * Cache of decoded, uploaded sounds, so that firing the same effect again
+ * costs a table lookup instead of a file mapping, a conversion pass and an
+ * alBufferData copy.
+ *
+ * Sounds are keyed by path, and each entry remembers the file's size and
+ * last write time plus an FNV-1a hash of its contents.  A lookup whose file
+ * stamp still matches is a hit without touching the file; a changed stamp
+ * costs one hashing pass, and only a changed hash costs a reload.
+ *
+ * Memory is bounded by a byte budget of system memory, evicting the least
+ * recently used sounds nobody holds a reference to.  With X-RAM on the card,
+ * its free memory (per probe_EAX_RAM) is a second tier filled first.  A
+ * sound played on a voice stays referenced until the voice lets it go, so
+ * eviction never has to find its buffer still attached.
+ */
+#define CACHE_BUCKETS   64 /* power of two */
+
+typedef struct cached_sound {
+    char path[MAX_PATH];
+    ALuint path_hash;
+    ALuint content_hash;
+    FILETIME written;
+    DWORD file_size;
+
+    ALuint buffer;
+    ALsizei bytes; /* as uploaded, after any format conversion */
+    ALboolean in_XRAM;
+    ALint refs;
+    ALboolean stale; /* file changed while referenced; off the hash table */
+
+    struct cached_sound* chain; /* next in the same hash bucket */
+    struct cached_sound* newer; /* LRU list, most recently used at `newest` */
+    struct cached_sound* older;
+} cached_sound;
+
+typedef struct {
+    cached_sound* buckets[CACHE_BUCKETS];
+    cached_sound* newest;
+    cached_sound* oldest;
+    ALboolean upload_float;
+
+    ALsizei budget; /* system memory, in bytes */
+    ALsizei used;
+    ALsizei XRAM_budget; /* 0 without X-RAM */
+    ALsizei XRAM_used;
+
+    ALuint hits;
+    ALuint rehashes; /* stamp changed but the contents did not */
+    ALuint loads;
+    ALuint evictions;
+} sound_cache;
+
+ALuint FNV_1a(const ALubyte* data, ALsizei size, ALuint hash)
+{
+    register ALsizei i;
+
+    for (i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return (hash);
+}
+#define FNV_BASIS       2166136261u
+
+void open_sound_cache(sound_cache* cache, ALsizei budget,
+    ALboolean upload_float)
+{
+    memset(cache, 0, sizeof(sound_cache));
+    cache->budget = budget;
+    cache->upload_float = upload_float;
+    if (probe_EAX_RAM())
+        cache->XRAM_budget = XRAM_free;
+    return;
+}
+
+void unlink_LRU(sound_cache* cache, cached_sound* sound)
+{
+    if (sound->newer != NULL)
+        sound->newer->older = sound->older;
+    else
+        cache->newest = sound->older;
+    if (sound->older != NULL)
+        sound->older->newer = sound->newer;
+    else
+        cache->oldest = sound->newer;
+    sound->newer = sound->older = NULL;
+    return;
+}
+
+void touch_LRU(sound_cache* cache, cached_sound* sound)
+{
+    if (cache->newest == sound)
+        return;
+    if (sound->newer != NULL || sound->older != NULL || cache->oldest == sound)
+        unlink_LRU(cache, sound);
+    sound->older = cache->newest;
+    if (cache->newest != NULL)
+        cache->newest->newer = sound;
+    cache->newest = sound;
+    if (cache->oldest == NULL)
+        cache->oldest = sound;
+    return;
+}
+
+void unlink_bucket(sound_cache* cache, cached_sound* sound)
+{
+    cached_sound** link;
+
+    link = &cache->buckets[sound->path_hash & (CACHE_BUCKETS - 1)];
+    while (*link != NULL && *link != sound)
+        link = &(*link)->chain;
+    if (*link != NULL)
+        *link = sound->chain;
+    sound->chain = NULL;
+    return;
+}
+
+/*
+ * Delete a sound's buffer and forget it.  Fails, keeping the entry, while
+ * some source (a voice still playing it, say) has the buffer attached.
+ */
+ALboolean drop_sound(sound_cache* cache, cached_sound* sound)
+{
+    alGetError();
+    alDeleteBuffers(1, &sound->buffer);
+    if (alGetError() != AL_NO_ERROR)
+        return AL_FALSE;
+    if (sound->in_XRAM)
+        cache->XRAM_used -= sound->bytes;
+    else
+        cache->used -= sound->bytes;
+    if (!sound->stale)
+        unlink_bucket(cache, sound);
+    unlink_LRU(cache, sound);
+    free(sound);
+    return AL_TRUE;
+}
+
+/*
+ * Evict unreferenced sounds of one tier, oldest first, until `bytes` more
+ * fit in it.  Returns AL_FALSE if they cannot be made to.
+ */
+ALboolean make_room(sound_cache* cache, ALboolean XRAM, ALsizei bytes)
+{
+    const ALsizei budget = XRAM ? cache->XRAM_budget : cache->budget;
+    cached_sound* sound = cache->oldest;
+
+    if (bytes > budget)
+        return AL_FALSE;
+    while ((XRAM ? cache->XRAM_used : cache->used) + bytes > budget)
+    {
+        cached_sound* newer;
+
+        while (sound != NULL && (sound->refs != 0 || sound->in_XRAM != XRAM))
+            sound = sound->newer;
+        if (sound == NULL)
+            return AL_FALSE;
+        newer = sound->newer;
+        if (drop_sound(cache, sound))
+            ++cache->evictions;
+        sound = newer;
+    }
+    return AL_TRUE;
+}
+
+/*
+ * Upload `wave` into a new buffer on whichever tier has room for it.
+ */
+ALboolean upload_sound(sound_cache* cache, cached_sound* sound,
+    const wave_file* wave)
+{
+    sound->bytes = wave_upload_size(wave, cache->upload_float);
+    if (cache->XRAM_used + sound->bytes <= cache->XRAM_budget)
+        sound->in_XRAM = AL_TRUE; /* free X-RAM first, without evicting */
+    else if (make_room(cache, AL_FALSE, sound->bytes))
+        sound->in_XRAM = AL_FALSE;
+    else if (make_room(cache, AL_TRUE, sound->bytes))
+        sound->in_XRAM = AL_TRUE;
+    else
+    {
+        printf("Sound cache is full of sounds in use; \"%s\" refused.\n",
+            sound->path);
+        return AL_FALSE;
+    }
+
+    alGetError();
+    alGenBuffers(1, &sound->buffer);
+    if (alGetError() != AL_NO_ERROR)
+        return AL_FALSE;
+    if (eaxSetBufferMode != NULL)
+        eaxSetBufferMode(1, &sound->buffer,
+            sound->in_XRAM ? XRAM_hardware : XRAM_accessible);
+    if (upload_wave(sound->buffer, wave, cache->upload_float) == AL_FALSE
+     || alGetError() != AL_NO_ERROR)
+    {
+        alDeleteBuffers(1, &sound->buffer);
+        return AL_FALSE;
+    }
+    if (sound->in_XRAM)
+        cache->XRAM_used += sound->bytes;
+    else
+        cache->used += sound->bytes;
+    ++cache->loads;
+    return AL_TRUE;
+}
+
+/*
+ * Take a reference to the sound at `path`, loading it only if it is not
+ * cached or the file's contents have changed.  Returns NULL on failure.
+ * Every success must be matched by release_sound().
+ */
+cached_sound* acquire_sound(sound_cache* cache, const char* path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA stamp;
+    const ALuint path_hash =
+        FNV_1a((const ALubyte *)path, (ALsizei)strlen(path), FNV_BASIS);
+    cached_sound** bucket = &cache->buckets[path_hash & (CACHE_BUCKETS - 1)];
+    cached_sound* sound;
+    wave_file wave;
+    ALuint content_hash;
+
+    if (strlen(path) >= MAX_PATH
+     || GetFileAttributesEx(path, GetFileExInfoStandard, &stamp) == 0)
+    {
+        printf("Unable to find \"%s\".\n", path);
+        return NULL;
+    }
+    for (sound = *bucket; sound != NULL; sound = sound->chain)
+        if (sound->path_hash == path_hash && strcmp(sound->path, path) == 0)
+            break;
+    if (sound != NULL
+     && sound->file_size == stamp.nFileSizeLow
+     && memcmp(&sound->written, &stamp.ftLastWriteTime, sizeof(FILETIME)) == 0)
+    {
+        ++cache->hits;
+        ++sound->refs;
+        touch_LRU(cache, sound);
+        return (sound);
+    }
+
+    if (open_wave(&wave, path) == AL_FALSE)
+        return NULL;
+    content_hash = FNV_1a(wave.view, wave.view_size, FNV_BASIS);
+    if (sound != NULL)
+    {
+        if (sound->content_hash == content_hash)
+        { /* touched but not changed */
+            sound->written = stamp.ftLastWriteTime;
+            sound->file_size = stamp.nFileSizeLow;
+            close_wave(&wave);
+            ++cache->rehashes;
+            ++sound->refs;
+            touch_LRU(cache, sound);
+            return (sound);
+        }
+        unlink_bucket(cache, sound);
+        sound->stale = AL_TRUE; /* freed once the last reference goes */
+        if (sound->refs == 0)
+            drop_sound(cache, sound);
+    }
+
+    if (wave.format == AL_NONE)
+    {
+        printf("Unsupported WAVE format:  %i channels, %i bits, tag 0x%04X\n",
+            wave.channels, wave.bits, wave.format_tag);
+        close_wave(&wave);
+        return NULL;
+    }
+    sound = (cached_sound *)calloc(1, sizeof(cached_sound));
+    if (sound == NULL)
+    {
+        close_wave(&wave);
+        return NULL;
+    }
+    strcpy(sound->path, path);
+    sound->path_hash = path_hash;
+    sound->content_hash = content_hash;
+    sound->written = stamp.ftLastWriteTime;
+    sound->file_size = stamp.nFileSizeLow;
+    if (upload_sound(cache, sound, &wave) == AL_FALSE)
+    {
+        free(sound);
+        close_wave(&wave);
+        return NULL;
+    }
+    close_wave(&wave); /* AL has its own copy now. */
+
+    sound->refs = 1;
+    sound->chain = *bucket;
+    *bucket = sound;
+    touch_LRU(cache, sound);
+    return (sound);
+}
+
+void release_sound(sound_cache* cache, cached_sound* sound)
+{
+    --sound->refs;
+    if (sound->refs == 0 && sound->stale)
+        drop_sound(cache, sound);
+    return;
+}
+
+void release_held_sound(ALvoid* cache, ALvoid* sound)
+{
+    release_sound((sound_cache *)cache, (cached_sound *)sound);
+    return;
+}
+
+/*
+ * Play `sound` once on the pool, handing it the caller's reference, which
+ * goes back to the cache when the voice is reclaimed or stolen.  Returns 0,
+ * the reference released, if no voice could be had at this priority.
+ */
+voice_handle play_sound(voice_pool* pool, sound_cache* cache,
+    cached_sound* sound, ALfloat gain, ALint priority)
+{
+    voice_handle voice;
+
+    pool->release = release_held_sound;
+    pool->release_user = cache;
+    voice = play_held_voice(pool, sound->buffer, gain, priority, sound);
+    if (voice == 0)
+        release_sound(cache, sound);
+    return (voice);
+}
+
+/*
+ * Drop every sound.  Sources must be done with the buffers by now.
+ */
+void close_sound_cache(sound_cache* cache)
+{
+    while (cache->oldest != NULL)
+        if (drop_sound(cache, cache->oldest) == AL_FALSE)
+        {
+            printf("Sound cache:  \"%s\" is still attached to a source.\n",
+                cache->oldest->path);
+            break;
+        }
+    return;
+}
+
+void log_sound_cache(const sound_cache* cache)
+{
+    printf("Sound cache:  %i of %i bytes", cache->used, cache->budget);
+    if (cache->XRAM_budget != 0)
+        printf(" + %i of %i X-RAM", cache->XRAM_used, cache->XRAM_budget);
+    printf(", %u hits, %u rehashes, %u loads, %u evictions\n",
+        cache->hits, cache->rehashes, cache->loads, cache->evictions);
+    return;
+}
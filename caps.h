@@ -0,0 +1,238 @@
+/*
+ * Snapshot of what the driver and device can do, cached in ALCAPS.BIN.
+ *
+ * Enumerating every playback and capture device can mean waking up every
+ * audio backend on the system, and the full text dumps of ALSTATES.TXT and
+ * DCSTATES.TXT cost as much again.  None of that changes until the driver
+ * or the device does, so the extensions we care about (as a bitset), the
+ * device list, the context attributes and the X-RAM size are saved once,
+ * keyed by vendor, version, renderer and device name.  Later runs ask AL for
+ * only those four strings; if they match, the snapshot comes off the disk
+ * and the text dumps are left as they were.  On a miss, the snapshot is
+ * rebuilt and the dumps are rewritten from a background thread.
+ */
+#define CAPS_MAGIC      0x32504143 /* "CAP2" */
+#define CAPS_KEY_SIZE   64
+#define CAPS_DEVICES    2048
+#define CAPS_ATTRIBUTES 64
+
+void log_AL_states(void);
+void log_AL_device_states(ALCdevice* device);
+
+enum {
+    CAP_EXT_FLOAT32,
+    CAP_SOFT_DEFERRED_UPDATES,
+    CAP_SOFT_EVENTS,
+    CAP_SOFT_CALLBACK_BUFFER,
+    CAP_SOFT_SOURCE_LATENCY,
+    CAP_SOFT_MAP_BUFFER,
+    CAP_EXT_IMA4,
+    CAP_SOFT_MSADPCM,
+    CAP_SOFT_BLOCK_ALIGNMENT,
+    CAP_EAX_RAM,
+    CAP_ALC_SOFT_LOOPBACK, /* ALC extensions from here on */
+    CAP_ALC_ENUMERATE_ALL,
+    CAP_ALC_THREAD_LOCAL_CONTEXT,
+    CAP_COUNT
+};
+
+const char* cap_names[CAP_COUNT] = {
+    "AL_EXT_FLOAT32",
+    "AL_SOFT_deferred_updates",
+    "AL_SOFT_events",
+    "AL_SOFT_callback_buffer",
+    "AL_SOFT_source_latency",
+    "AL_SOFT_map_buffer",
+    "AL_EXT_IMA4",
+    "AL_SOFT_MSADPCM",
+    "AL_SOFT_block_alignment",
+    "EAX-RAM",
+    "ALC_SOFT_loopback",
+    "ALC_ENUMERATE_ALL_EXT",
+    "ALC_EXT_thread_local_context"
+};
+
+typedef struct {
+    ALuint magic;
+    ALuint size; /* sizeof(AL_caps), in case the layout changes */
+
+    char vendor[CAPS_KEY_SIZE]; /* the key */
+    char version[CAPS_KEY_SIZE];
+    char renderer[CAPS_KEY_SIZE];
+    char device[CAPS_KEY_SIZE];
+
+    ALuint extensions; /* bit n set if cap_names[n] is supported */
+    ALCint major, minor; /* ALC version */
+    char devices[CAPS_DEVICES]; /* null-separated, double-null terminated */
+    ALCint attributes[CAPS_ATTRIBUTES]; /* ALC_ALL_ATTRIBUTES */
+    ALint XRAM_size; /* bytes, 0 without X-RAM */
+} AL_caps;
+
+ALboolean has_cap(const AL_caps* caps, int cap)
+{
+    return (caps->extensions >> cap) & 1;
+}
+
+/*
+ * The snapshot the feature checks below go by, once main() has one.  The
+ * benchmarks, renders and plugin demo never load one, so they ask AL.
+ */
+const AL_caps* AL_snapshot = NULL;
+
+ALboolean have_cap(int cap)
+{
+    ALCcontext* context;
+
+    if (AL_snapshot != NULL)
+        return has_cap(AL_snapshot, cap);
+    if (cap < CAP_ALC_SOFT_LOOPBACK)
+        return alIsExtensionPresent(cap_names[cap]);
+    context = alcGetCurrentContext();
+    return alcIsExtensionPresent(
+        (context != NULL) ? alcGetContextsDevice(context) : NULL,
+        cap_names[cap]);
+}
+
+void copy_key(char* key, const char* text)
+{
+    strncpy(key, (text != NULL) ? text : "", CAPS_KEY_SIZE - 1);
+    key[CAPS_KEY_SIZE - 1] = '\0';
+    return;
+}
+
+/*
+ * The four strings telling one driver and device apart from another.
+ */
+void read_caps_key(AL_caps* caps, ALCdevice* device)
+{
+    memset(caps, 0, sizeof(AL_caps));
+    caps->magic = CAPS_MAGIC;
+    caps->size = sizeof(AL_caps);
+    copy_key(caps->vendor, alGetString(AL_VENDOR));
+    copy_key(caps->version, alGetString(AL_VERSION));
+    copy_key(caps->renderer, alGetString(AL_RENDERER));
+    copy_key(caps->device, alcGetString(device, ALC_DEVICE_SPECIFIER));
+    return;
+}
+
+/*
+ * The slow part:  fill in everything besides the key.
+ */
+void probe_caps(AL_caps* caps, ALCdevice* device)
+{
+    const ALCchar* list;
+    ALCint count;
+    register int i;
+
+    for (i = 0; i < CAP_COUNT; i++)
+    {
+        const ALboolean found = (i < CAP_ALC_SOFT_LOOPBACK)
+            ? alIsExtensionPresent(cap_names[i])
+            : alcIsExtensionPresent(device, cap_names[i]);
+
+        if (found)
+            caps->extensions |= 1u << i;
+    }
+    alcGetIntegerv(device, ALC_MAJOR_VERSION, 1, &caps->major);
+    alcGetIntegerv(device, ALC_MINOR_VERSION, 1, &caps->minor);
+
+    list = alcGetString(NULL, has_cap(caps, CAP_ALC_ENUMERATE_ALL)
+        ? ALC_ALL_DEVICES_SPECIFIER : ALC_DEVICE_SPECIFIER);
+    for (i = 0; list != NULL && i < CAPS_DEVICES - 2; i++)
+    { /* Copy the list through its double-null end, or as much as fits. */
+        caps->devices[i] = list[i];
+        if (list[i] == '\0' && list[i + 1] == '\0')
+            break;
+    }
+
+    alcGetIntegerv(device, ALC_ATTRIBUTES_SIZE, 1, &count);
+    if (count > 0 && count <= CAPS_ATTRIBUTES)
+        alcGetIntegerv(device, ALC_ALL_ATTRIBUTES, count, caps->attributes);
+
+    if (has_cap(caps, CAP_EAX_RAM))
+        caps->XRAM_size = alGetInteger(alGetEnumValue("AL_EAX_RAM_SIZE"));
+    return;
+}
+
+ALboolean load_caps(AL_caps* caps, const char* path)
+{
+    AL_caps cached;
+    FILE* in;
+    size_t got;
+
+    in = fopen(path, "rb");
+    if (in == NULL)
+        return AL_FALSE;
+    got = fread(&cached, sizeof(AL_caps), 1, in);
+    fclose(in);
+    if (got != 1
+     || cached.magic != CAPS_MAGIC || cached.size != sizeof(AL_caps)
+     || memcmp(cached.vendor, caps->vendor, CAPS_KEY_SIZE) != 0
+     || memcmp(cached.version, caps->version, CAPS_KEY_SIZE) != 0
+     || memcmp(cached.renderer, caps->renderer, CAPS_KEY_SIZE) != 0
+     || memcmp(cached.device, caps->device, CAPS_KEY_SIZE) != 0)
+        return AL_FALSE;
+    *caps = cached;
+    return AL_TRUE;
+}
+
+void save_caps(const AL_caps* caps, const char* path)
+{
+    FILE* out;
+
+    out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        printf("Unable to write %s.\n", path);
+        return;
+    }
+    fwrite(caps, sizeof(AL_caps), 1, out);
+    fclose(out);
+    return;
+}
+
+/*
+ * Writes ALSTATES.TXT and DCSTATES.TXT without holding up start-up.
+ */
+DWORD WINAPI dump_states_main(LPVOID param)
+{
+    log_AL_device_states((ALCdevice *)param);
+    log_AL_states();
+    return 0;
+}
+
+/*
+ * Fill `caps` for the current context, from ALCAPS.BIN if it still applies.
+ * Returns AL_TRUE on a cache hit.  On a miss, the text dumps get rewritten
+ * in the background; the returned thread handle (or NULL) must be waited
+ * on before the context goes away.
+ */
+ALboolean get_caps(AL_caps* caps, ALCdevice* device, HANDLE* dumper)
+{
+    *dumper = NULL;
+    read_caps_key(caps, device);
+    if (load_caps(caps, "ALCAPS.BIN"))
+        return AL_TRUE;
+    probe_caps(caps, device);
+    save_caps(caps, "ALCAPS.BIN");
+    *dumper = CreateThread(NULL, 0, dump_states_main, device, 0, NULL);
+    if (*dumper != NULL)
+        SetThreadPriority(*dumper, THREAD_PRIORITY_LOWEST);
+    return AL_FALSE;
+}
+
+void log_caps(const AL_caps* caps, ALboolean cached)
+{
+    register int i;
+
+    printf("%s %s on \"%s\" (ALC %i.%i), %s:\n ", caps->vendor,
+        caps->version, caps->device, caps->major, caps->minor,
+        cached ? "capabilities cached" : "capabilities probed");
+    for (i = 0; i < CAP_COUNT; i++)
+        if (has_cap(caps, i))
+            printf(" %s", cap_names[i]);
+    printf("\n");
+    if (caps->XRAM_size != 0)
+        printf("X-RAM:  %i MiB\n", caps->XRAM_size / (1024*1024));
+    return;
+}
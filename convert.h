@@ -0,0 +1,625 @@
+/*
+ * Sample-format conversion in front of alBufferData.
+ *
+ * N64 audio comes in as big-endian 16-bit stereo with the two channels
+ * swapped in each 32-bit word, WAVE files carry unsigned 8-bit or signed
+ * 16-bit samples, and AL_EXT_FLOAT32 devices may rather take floats.  Each
+ * conversion has a scalar kernel plus SSE2 and AVX2 ones; the fastest the
+ * CPU can run is picked once at start-up by init_converter().
+ */
+#if defined(_M_IX86) || defined(_M_X64) \
+ || defined(__i386__) || defined(__x86_64__)
+#define CONVERT_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_AVX2     __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+/*
+ * Flags describing how incoming 16-bit samples deviate from native order.
+ */
+#define SAMPLE_BIG_ENDIAN   0x0001 /* each 16-bit sample is byte-swapped */
+#define SAMPLE_SWAP_HALVES  0x0002 /* L and R swapped within 32-bit words */
+
+ALsizei format_channels(ALenum format)
+{
+    switch (format)
+    {
+        case AL_FORMAT_MONO8:
+        case AL_FORMAT_MONO16:
+        case AL_FORMAT_MONO_FLOAT32:
+            return 1;
+        case AL_FORMAT_STEREO8:
+        case AL_FORMAT_STEREO16:
+        case AL_FORMAT_STEREO_FLOAT32:
+            return 2;
+    }
+    return 0;
+}
+
+ALsizei format_frame_size(ALenum format)
+{
+    switch (format)
+    {
+        case AL_FORMAT_MONO8:           return 1;
+        case AL_FORMAT_MONO16:          return 2;
+        case AL_FORMAT_STEREO8:         return 2;
+        case AL_FORMAT_STEREO16:        return 4;
+        case AL_FORMAT_MONO_FLOAT32:    return 4;
+        case AL_FORMAT_STEREO_FLOAT32:  return 8;
+    }
+    return 0; /* unknown or compressed format */
+}
+
+ALenum float_format(ALenum format)
+{
+    return (format_channels(format) == 1)
+        ? AL_FORMAT_MONO_FLOAT32 : AL_FORMAT_STEREO_FLOAT32;
+}
+
+ALenum int16_format(ALenum format)
+{
+    return (format_channels(format) == 1)
+        ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+}
+
+typedef struct {
+    void (*swap_bytes)(ALshort* dst, const ALshort* src, ALsizei count);
+    void (*swap_halves)(ALshort* dst, const ALshort* src, ALsizei count);
+    void (*u8_to_s16)(ALshort* dst, const ALubyte* src, ALsizei count);
+    void (*s16_to_f32)(ALfloat* dst, const ALshort* src, ALsizei count);
+    void (*f32_to_s16)(ALshort* dst, const ALfloat* src, ALsizei count);
+    void (*upmix)(ALshort* dst, const ALshort* src, ALsizei frames);
+    void (*downmix)(ALshort* dst, const ALshort* src, ALsizei frames);
+    const char* name;
+} sample_converter;
+
+/*
+ * scalar kernels
+ * These also finish off whatever tail the vector kernels leave over.
+ */
+void swap_bytes_C(ALshort* dst, const ALshort* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i < count; i++)
+        dst[i] = (ALshort)(((ALushort)src[i] >> 8) | ((ALushort)src[i] << 8));
+    return;
+}
+void swap_halves_C(ALshort* dst, const ALshort* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i + 1 < count; i += 2)
+    {
+        const ALshort swap = src[i + 0];
+
+        dst[i + 0] = src[i + 1];
+        dst[i + 1] = swap;
+    }
+    return;
+}
+void u8_to_s16_C(ALshort* dst, const ALubyte* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i < count; i++)
+        dst[i] = (ALshort)(((ALint)src[i] - 128) * 256);
+    return;
+}
+void s16_to_f32_C(ALfloat* dst, const ALshort* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i < count; i++)
+        dst[i] = src[i] * (1.0F / 32768.0F);
+    return;
+}
+/*
+ * Clamps and rounds half to even exactly as _mm_min_ps, _mm_max_ps and
+ * _mm_cvtps_epi32 do (NaN included), so every kernel and every vector tail
+ * agrees to the bit.
+ */
+void f32_to_s16_C(ALshort* dst, const ALfloat* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i < count; i++)
+    {
+        ALfloat sample = src[i] * 32768.0F;
+        ALfloat fraction;
+        ALint whole;
+
+        sample = (sample < +32767.0F) ? sample : +32767.0F;
+        sample = (sample > -32768.0F) ? sample : -32768.0F;
+        whole = (ALint)sample; /* toward zero... */
+        if (sample < whole)
+            --whole; /* ...then down to the floor */
+        fraction = sample - whole;
+        if (fraction > 0.5F || (fraction == 0.5F && (whole & 1)))
+            ++whole;
+        dst[i] = (ALshort)whole;
+    }
+    return;
+}
+void upmix_C(ALshort* dst, const ALshort* src, ALsizei frames)
+{
+    register ALsizei i;
+
+    for (i = frames - 1; i >= 0; i--) /* backwards, in case dst == src */
+        dst[2*i + 0] = dst[2*i + 1] = src[i];
+    return;
+}
+void downmix_C(ALshort* dst, const ALshort* src, ALsizei frames)
+{
+    register ALsizei i;
+
+    for (i = 0; i < frames; i++)
+        dst[i] = (ALshort)((src[2*i + 0] + src[2*i + 1]) >> 1);
+    return;
+}
+
+#ifdef CONVERT_SIMD
+/*
+ * SSE2 kernels, eight 16-bit samples per step
+ */
+void swap_bytes_SSE2(ALshort* dst, const ALshort* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+        _mm_storeu_si128((__m128i *)(dst + i),
+            _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+    swap_bytes_C(dst + i, src + i, count - i);
+    return;
+}
+void swap_halves_SSE2(ALshort* dst, const ALshort* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+    swap_halves_C(dst + i, src + i, count - i);
+    return;
+}
+void u8_to_s16_SSE2(ALshort* dst, const ALubyte* src, ALsizei count)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i zero = _mm_setzero_si128();
+    register ALsizei i;
+
+/*
+ * Flipping the top bit makes the bytes signed; unpacking them into the high
+ * half of each 16-bit lane multiplies them by 256.
+ */
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+        v = _mm_xor_si128(v, bias);
+        _mm_storeu_si128((__m128i *)(dst + i + 0), _mm_unpacklo_epi8(zero, v));
+        _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(zero, v));
+    }
+    u8_to_s16_C(dst + i, src + i, count - i);
+    return;
+}
+void s16_to_f32_SSE2(ALfloat* dst, const ALshort* src, ALsizei count)
+{
+    const __m128 scale = _mm_set1_ps(1.0F / 32768.0F);
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    s16_to_f32_C(dst + i, src + i, count - i);
+    return;
+}
+void f32_to_s16_SSE2(ALshort* dst, const ALfloat* src, ALsizei count)
+{
+    const __m128 scale = _mm_set1_ps(32768.0F);
+    const __m128 top = _mm_set1_ps(+32767.0F);
+    const __m128 bottom = _mm_set1_ps(-32768.0F);
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i + 0), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+
+        a = _mm_max_ps(_mm_min_ps(a, top), bottom);
+        b = _mm_max_ps(_mm_min_ps(b, top), bottom);
+        _mm_storeu_si128((__m128i *)(dst + i),
+            _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    f32_to_s16_C(dst + i, src + i, count - i);
+    return;
+}
+void upmix_SSE2(ALshort* dst, const ALshort* src, ALsizei frames)
+{
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+        _mm_storeu_si128((__m128i *)(dst + 2*i + 0), _mm_unpacklo_epi16(v, v));
+        _mm_storeu_si128((__m128i *)(dst + 2*i + 8), _mm_unpackhi_epi16(v, v));
+    }
+    upmix_C(dst + 2*i, src + i, frames - i);
+    return;
+}
+void downmix_SSE2(ALshort* dst, const ALshort* src, ALsizei frames)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2*i + 0));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2*i + 8));
+
+        a = _mm_srai_epi32(_mm_madd_epi16(a, ones), 1); /* (L + R) >> 1 */
+        b = _mm_srai_epi32(_mm_madd_epi16(b, ones), 1);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+    downmix_C(dst + i, src + 2*i, frames - i);
+    return;
+}
+
+/*
+ * AVX2 kernels, sixteen 16-bit samples per step
+ * The 256-bit pack and unpack instructions work within each 128-bit lane,
+ * hence the cross-lane permutes putting samples back in order.
+ */
+TARGET_AVX2
+void swap_bytes_AVX2(ALshort* dst, const ALshort* src, ALsizei count)
+{
+    const __m256i mask = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+
+        _mm256_storeu_si256((__m256i *)(dst + i),
+            _mm256_shuffle_epi8(v, mask));
+    }
+    swap_bytes_C(dst + i, src + i, count - i);
+    return;
+}
+TARGET_AVX2
+void swap_halves_AVX2(ALshort* dst, const ALshort* src, ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+
+        v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm256_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+    swap_halves_C(dst + i, src + i, count - i);
+    return;
+}
+TARGET_AVX2
+void u8_to_s16_AVX2(ALshort* dst, const ALubyte* src, ALsizei count)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m256i wide;
+
+        v = _mm_xor_si128(v, bias);
+        wide = _mm256_slli_epi16(_mm256_cvtepi8_epi16(v), 8);
+        _mm256_storeu_si256((__m256i *)(dst + i), wide);
+    }
+    u8_to_s16_C(dst + i, src + i, count - i);
+    return;
+}
+TARGET_AVX2
+void s16_to_f32_AVX2(ALfloat* dst, const ALshort* src, ALsizei count)
+{
+    const __m256 scale = _mm256_set1_ps(1.0F / 32768.0F);
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(src + i + 0));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+
+        _mm256_storeu_ps(dst + i + 0, _mm256_mul_ps(scale,
+            _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(a))));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(scale,
+            _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(b))));
+    }
+    s16_to_f32_C(dst + i, src + i, count - i);
+    return;
+}
+TARGET_AVX2
+void f32_to_s16_AVX2(ALshort* dst, const ALfloat* src, ALsizei count)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0F);
+    const __m256 top = _mm256_set1_ps(+32767.0F);
+    const __m256 bottom = _mm256_set1_ps(-32768.0F);
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i + 0), scale);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+        __m256i packed;
+
+        a = _mm256_max_ps(_mm256_min_ps(a, top), bottom);
+        b = _mm256_max_ps(_mm256_min_ps(b, top), bottom);
+        packed = _mm256_packs_epi32(
+            _mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    f32_to_s16_C(dst + i, src + i, count - i);
+    return;
+}
+TARGET_AVX2
+void upmix_AVX2(ALshort* dst, const ALshort* src, ALsizei frames)
+{
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= frames; i += 16)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        const __m256i lo = _mm256_unpacklo_epi16(v, v);
+        const __m256i hi = _mm256_unpackhi_epi16(v, v);
+
+        _mm256_storeu_si256((__m256i *)(dst + 2*i + 0),
+            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 2*i + 16),
+            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    upmix_C(dst + 2*i, src + i, frames - i);
+    return;
+}
+TARGET_AVX2
+void downmix_AVX2(ALshort* dst, const ALshort* src, ALsizei frames)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    register ALsizei i;
+
+    for (i = 0; i + 16 <= frames; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + 2*i + 0));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + 2*i + 16));
+        __m256i packed;
+
+        a = _mm256_srai_epi32(_mm256_madd_epi16(a, ones), 1);
+        b = _mm256_srai_epi32(_mm256_madd_epi16(b, ones), 1);
+        packed = _mm256_packs_epi32(a, b);
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    downmix_C(dst + i, src + 2*i, frames - i);
+    return;
+}
+#endif
+
+/*
+ * CPU feature detection
+ * AVX2 needs the OS to save the YMM registers too, not only the CPUID bit.
+ */
+#define CPU_SSE2        0x0001
+#define CPU_AVX2        0x0002
+
+int detect_CPU_features(void)
+{
+    int features = 0;
+#if defined(CONVERT_SIMD) && defined(_MSC_VER)
+    int regs[4];
+
+    __cpuid(regs, 0);
+    if (regs[0] < 1)
+        return 0;
+    __cpuid(regs, 1);
+    if (regs[3] & (1 << 26))
+        features |= CPU_SSE2;
+    if ((regs[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6)
+    { /* OSXSAVE is set, and XCR0 says the OS preserves XMM and YMM state. */
+        __cpuidex(regs, 7, 0);
+        if (regs[1] & (1 << 5))
+            features |= CPU_AVX2;
+    }
+#elif defined(CONVERT_SIMD) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        features |= CPU_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        features |= CPU_AVX2;
+#endif
+    return (features);
+}
+
+sample_converter converter = {
+    swap_bytes_C, swap_halves_C, u8_to_s16_C, s16_to_f32_C, f32_to_s16_C,
+    upmix_C, downmix_C, "scalar"
+};
+
+void init_converter(void)
+{
+#ifdef CONVERT_SIMD
+    const int features = detect_CPU_features();
+
+    if (features & CPU_AVX2)
+    {
+        converter.swap_bytes  = swap_bytes_AVX2;
+        converter.swap_halves = swap_halves_AVX2;
+        converter.u8_to_s16   = u8_to_s16_AVX2;
+        converter.s16_to_f32  = s16_to_f32_AVX2;
+        converter.f32_to_s16  = f32_to_s16_AVX2;
+        converter.upmix       = upmix_AVX2;
+        converter.downmix     = downmix_AVX2;
+        converter.name        = "AVX2";
+    }
+    else if (features & CPU_SSE2)
+    {
+        converter.swap_bytes  = swap_bytes_SSE2;
+        converter.swap_halves = swap_halves_SSE2;
+        converter.u8_to_s16   = u8_to_s16_SSE2;
+        converter.s16_to_f32  = s16_to_f32_SSE2;
+        converter.f32_to_s16  = f32_to_s16_SSE2;
+        converter.upmix       = upmix_SSE2;
+        converter.downmix     = downmix_SSE2;
+        converter.name        = "SSE2";
+    }
+#endif
+    return;
+}
+
+/*
+ * Float to float, only ever remixing channels:  going by way of 16-bit
+ * would clip a mix bus's sum on its way into the resampler.
+ */
+void convert_floats(ALfloat* dst, ALsizei out_channels,
+    const ALfloat* src, ALsizei in_channels, ALsizei frames)
+{
+    register ALsizei i;
+
+    if (in_channels == out_channels)
+        memmove(dst, src, frames * out_channels * sizeof(ALfloat));
+    else if (in_channels == 1)
+        for (i = frames - 1; i >= 0; i--) /* backwards, in case dst == src */
+            dst[2*i + 0] = dst[2*i + 1] = src[i];
+    else
+        for (i = 0; i < frames; i++)
+            dst[i] = 0.5F * (src[2*i + 0] + src[2*i + 1]);
+    return;
+}
+
+/*
+ * Convert `frames` sample frames from `in_format` (as modified by `flags`)
+ * to `out_format`, which must be 16-bit or float.  Works through the frames
+ * in short blocks, so that every pass over the samples stays in L1 cache.
+ *
+ * Returns the count of bytes written to `dst`.
+ */
+#define CONVERT_BLOCK   1024
+
+ALsizei convert_samples(
+    ALvoid* dst, ALenum out_format,
+    const ALvoid* src, ALenum in_format, ALuint flags, ALsizei frames)
+{
+    ALshort one[2 * CONVERT_BLOCK], two[2 * CONVERT_BLOCK];
+    const ALsizei in_channels = format_channels(in_format);
+    const ALsizei out_channels = format_channels(out_format);
+    const ALsizei in_size = format_frame_size(in_format);
+    const ALsizei out_size = format_frame_size(out_format);
+    const ALboolean in_float = (in_size == 4 * in_channels);
+    const ALboolean out_float = (out_size == 4 * out_channels);
+    const ALubyte* in = (const ALubyte *)src;
+    ALubyte* out = (ALubyte *)dst;
+    const ALsizei total = frames * out_size;
+
+    if (in_float && out_float) /* `flags` only concern 16-bit samples */
+    {
+        convert_floats((ALfloat *)dst, out_channels,
+            (const ALfloat *)src, in_channels, frames);
+        return (total);
+    }
+    while (frames > 0)
+    {
+        const ALsizei count = (frames < CONVERT_BLOCK) ? frames : CONVERT_BLOCK;
+        const ALsizei samples = count * in_channels;
+        const ALshort* pcm;
+
+        if (in_size == in_channels) /* 8-bit */
+        {
+            converter.u8_to_s16(one, in, samples);
+            pcm = one;
+        }
+        else if (in_float)
+        {
+            converter.f32_to_s16(one, (const ALfloat *)in, samples);
+            pcm = one;
+        }
+        else
+            pcm = (const ALshort *)in;
+        if (flags & SAMPLE_BIG_ENDIAN)
+        {
+            converter.swap_bytes(one, pcm, samples);
+            pcm = one;
+        }
+        if (flags & SAMPLE_SWAP_HALVES)
+        {
+            converter.swap_halves(one, pcm, samples);
+            pcm = one;
+        }
+
+        if (in_channels != out_channels)
+        {
+            ALshort* mixed = out_float ? two : (ALshort *)out;
+
+            if (in_channels == 1)
+                converter.upmix(mixed, pcm, count);
+            else
+                converter.downmix(mixed, pcm, count);
+            pcm = mixed;
+        }
+        if (out_float)
+            converter.s16_to_f32((ALfloat *)out, pcm, count * out_channels);
+        else if (pcm != (const ALshort *)out)
+            memcpy(out, pcm, count * out_size);
+
+        in += count * in_size;
+        out += count * out_size;
+        frames -= count;
+    }
+    return (total);
+}
+
+/*
+ * alBufferData with the conversion step in front of it.  Audio already in
+ * `out_format` goes through untouched; anything else is converted into
+ * `scratch`, which must hold `frames` frames of `out_format`.
+ */
+void convert_buffer_data(
+    ALuint buf, ALenum out_format, const ALvoid* data, ALenum in_format,
+    ALuint flags, ALsizei frames, ALsizei frequency, ALvoid* scratch)
+{
+    ALsizei size;
+
+    if (out_format == in_format && flags == 0)
+        size = frames * format_frame_size(in_format);
+    else
+    {
+        size = convert_samples(scratch, out_format, data, in_format, flags,
+            frames);
+        data = scratch;
+    }
+    alBufferData(buf, out_format, data, size, frequency);
+    return;
+}
@@ -0,0 +1,214 @@
+/*
+ * Wake-ups for whoever refills a stream, instead of polling on a fixed beat.
+ *
+ * With AL_SOFT_events, the mixer reports each finished buffer and each
+ * change of source state through a callback on a thread of its own.  The
+ * callback may not call into AL, so all it does is count the event and set
+ * a Win32 event object, and the refill thread sleeps on that object until
+ * there is really something to do.
+ *
+ * Without the extension, the refill thread polls, but adapts the interval:
+ * it backs off while polls come up empty and closes in when a poll finds
+ * more than one buffer finished, staying between 1 ms and half a buffer.
+ */
+typedef struct {
+    HANDLE wake; /* auto-reset */
+    ALuint source;
+    ALboolean have_events;
+
+    volatile LONG completed; /* buffers finished, per callback */
+    volatile LONG state_changes;
+    volatile LONG disconnected;
+
+    DWORD interval; /* current poll interval, in milliseconds */
+    DWORD max_interval;
+
+    ALuint waits;
+    ALuint timeouts; /* waits that ended with nothing signaled */
+} stream_events;
+
+LPALEVENTCONTROLSOFT alEventControlSOFT;
+LPALEVENTCALLBACKSOFT alEventCallbackSOFT;
+
+/*
+ * Runs on the AL event thread.  No AL calls allowed in here.
+ */
+void AL_APIENTRY stream_event_callback(ALenum type, ALuint object,
+    ALuint param, ALsizei length, const ALchar* message, void* user)
+{
+    stream_events* events = (stream_events *)user;
+
+    switch (type)
+    {
+    case AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT:
+        if (object != events->source)
+            return;
+        InterlockedExchangeAdd(&events->completed, (LONG)param);
+        break;
+    case AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT:
+        if (object != events->source)
+            return;
+        InterlockedIncrement(&events->state_changes);
+        break;
+    case AL_EVENT_TYPE_DISCONNECTED_SOFT:
+        InterlockedExchange(&events->disconnected, 1);
+        break;
+    default:
+        return;
+    }
+    SetEvent(events->wake);
+    return;
+}
+
+/*
+ * Watch `source`, a stream of buffers `buffer_ms` long, starting the
+ * fallback poller at `period` milliseconds.
+ */
+ALboolean open_stream_events(stream_events* events, ALuint source,
+    DWORD buffer_ms, DWORD period)
+{
+    static const ALenum types[] = {
+        AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT,
+        AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT,
+        AL_EVENT_TYPE_DISCONNECTED_SOFT
+    };
+
+    memset(events, 0, sizeof(stream_events));
+    events->source = source;
+    events->max_interval = (buffer_ms / 2 > 1) ? buffer_ms / 2 : 1;
+    events->interval = (period < events->max_interval)
+        ? period : events->max_interval;
+    events->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (events->wake == NULL)
+    {
+        printf("Failed to create the stream wake-up event.\n");
+        return AL_FALSE;
+    }
+
+    if (have_cap(CAP_SOFT_EVENTS) == AL_FALSE)
+    {
+        printf("Failed to detect extension:  %s.\n", "AL_SOFT_events");
+        return AL_TRUE; /* The poller will do. */
+    }
+    alEventControlSOFT = (LPALEVENTCONTROLSOFT)
+        alGetProcAddress("alEventControlSOFT");
+    alEventCallbackSOFT = (LPALEVENTCALLBACKSOFT)
+        alGetProcAddress("alEventCallbackSOFT");
+    if (alEventControlSOFT == NULL || alEventCallbackSOFT == NULL)
+        return AL_TRUE;
+    alGetError();
+    alEventCallbackSOFT(stream_event_callback, events);
+    alEventControlSOFT(sizeof(types) / sizeof(types[0]), types, AL_TRUE);
+    events->have_events = (alGetError() == AL_NO_ERROR);
+    return AL_TRUE;
+}
+
+void close_stream_events(stream_events* events)
+{
+    if (events->have_events)
+    {
+        static const ALenum types[] = {
+            AL_EVENT_TYPE_BUFFER_COMPLETED_SOFT,
+            AL_EVENT_TYPE_SOURCE_STATE_CHANGED_SOFT,
+            AL_EVENT_TYPE_DISCONNECTED_SOFT
+        };
+
+        alEventControlSOFT(sizeof(types) / sizeof(types[0]), types,
+            AL_FALSE);
+        alEventCallbackSOFT(NULL, NULL);
+    }
+    if (events->wake != NULL)
+        CloseHandle(events->wake);
+    events->wake = NULL;
+    return;
+}
+
+/*
+ * Let the refill thread know now, say after alSourcePlay from the keyboard.
+ */
+void wake_stream(stream_events* events)
+{
+    SetEvent(events->wake);
+    return;
+}
+
+/*
+ * How long the refill thread may sleep, given what the last update_stream()
+ * did.  With events, only a stream short of data needs a timeout at all;
+ * otherwise the next finished buffer comes with a wake-up.
+ */
+DWORD next_stream_wait(stream_events* events, const AL_stream* stream,
+    ALint refilled)
+{
+    if (events->have_events)
+    {
+        if (stream->idle_count <= stream->depth - stream->active)
+            return (events->max_interval * 2); /* just a safety net */
+        return (events->interval);
+    }
+    if (refilled == 0 && events->interval < events->max_interval)
+        events->interval *= 2; /* nothing was due yet */
+    else if (refilled > 1 && events->interval > 1)
+        events->interval /= 2; /* more than one was due:  woke up late */
+    if (events->interval > events->max_interval)
+        events->interval = events->max_interval;
+    if (events->interval == 0)
+        events->interval = 1;
+    return (events->interval);
+}
+
+/*
+ * Sleep until a stream event or `ms` milliseconds, whichever is first.
+ * `also` may be another handle to wake on, such as the console input.
+ * Returns the index of the signaled handle, or -1 on a timeout.
+ */
+int wait_stream_event(stream_events* events, DWORD ms, HANDLE also)
+{
+    HANDLE handles[2];
+    DWORD status;
+
+    handles[0] = events->wake;
+    handles[1] = also;
+    ++events->waits;
+    status = WaitForMultipleObjects((also != NULL) ? 2 : 1, handles, FALSE,
+        ms);
+    if (status == WAIT_TIMEOUT)
+    {
+        ++events->timeouts;
+        return -1;
+    }
+    return (int)(status - WAIT_OBJECT_0);
+}
+
+/*
+ * Throw away the console input records _kbhit() ignores (key releases,
+ * mouse, focus and resizing), which would otherwise keep the console handle
+ * signaled and wait_stream_event() from ever sleeping on it.  Stops at the
+ * first key press, left for _getch().
+ */
+void drain_console_input(HANDLE console)
+{
+    INPUT_RECORD record;
+    DWORD count;
+
+    while (PeekConsoleInput(console, &record, 1, &count) && count != 0)
+    {
+        if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown
+         && record.Event.KeyEvent.uChar.AsciiChar != 0)
+            break;
+        ReadConsoleInput(console, &record, 1, &count);
+    }
+    return;
+}
+
+void log_stream_events(const stream_events* events)
+{
+    printf("Stream wake-ups (%s):  %u waits, %u timeouts, "
+        "%li buffers completed, %li state changes\n",
+        events->have_events ? "AL_SOFT_events" : "adaptive polling",
+        events->waits, events->timeouts, events->completed,
+        events->state_changes);
+    if (events->disconnected)
+        printf("The device was disconnected.\n");
+    return;
+}
@@ -0,0 +1,560 @@
+/*
+ * Loading ahead of playback on a small pool of worker threads.
+ *
+ * request_track() hands back a track at once.  A worker then maps the WAVE
+ * file, faults every page of its samples in and decodes the first few
+ * buffers' worth (the pre-roll), and only then marks the track ready, so
+ * whoever plays it never waits on the disk or on the decoder.  Callers may
+ * poll track_state() or block in wait_track() when they have nothing
+ * better to do, as at start-up.
+ *
+ * Every worker owns a deque of requests.  New requests are dealt out
+ * round-robin; a worker takes its own newest request first and, once out
+ * of work, steals the oldest one off another worker, so one slow file never
+ * holds up the requests queued behind it.
+ *
+ * A playlist plays tracks back to back through a single stream_fill or
+ * stream_peek.  The first samples of the next track follow the last samples
+ * of the current one in the same AL buffer, with no gap in between.
+ */
+#define MAX_LOAD_WORKERS        4
+#define LOAD_DEQUE_SIZE         32
+
+enum {
+    TRACK_PENDING,
+    TRACK_READY,
+    TRACK_FAILED
+};
+
+typedef struct track {
+    char path[MAX_PATH];
+    volatile LONG state; /* TRACK_* */
+    HANDLE done; /* manual-reset, set once `state` leaves TRACK_PENDING */
+    struct track* volatile retired; /* link in playlist.finished */
+
+    wave_file wave;
+    adpcm_reader decoder; /* ADPCM only:  the rest after the pre-roll */
+    ALsizei frame_size; /* bytes per frame of wave.pcm_format */
+    ALsizei preroll_frames; /* wanted when requested, then actually ready */
+    const ALubyte* preroll; /* the first frames, ready to play */
+    ALubyte* preroll_memory; /* decoded pre-roll (ADPCM), or NULL */
+    ALsizei position; /* frames played so far this time through */
+} track;
+
+typedef struct load_pool load_pool;
+
+typedef struct {
+    CRITICAL_SECTION lock;
+    track* jobs[LOAD_DEQUE_SIZE];
+    LONG head; /* oldest, where thieves take from */
+    LONG tail; /* newest, where the owner takes from */
+    load_pool* pool;
+} load_deque;
+
+struct load_pool {
+    load_deque deques[MAX_LOAD_WORKERS];
+    HANDLE threads[MAX_LOAD_WORKERS];
+    ALsizei workers;
+    HANDLE work; /* semaphore:  one count per request in any deque */
+    volatile LONG quit;
+    LONG next_deque; /* round-robin dealing of new requests */
+
+    volatile LONG loads;
+    volatile LONG steals;
+    volatile LONG failures;
+};
+
+/*
+ * Read one byte off every page so that later reads of the mapping never
+ * stop to page the file in.
+ */
+ALuint touch_pages(const ALubyte* data, ALsizei size)
+{
+    ALuint sum = 0;
+    register ALsizei i;
+
+    for (i = 0; i < size; i += 4096)
+        sum += data[i];
+    if (size > 0)
+        sum += data[size - 1];
+    return (sum);
+}
+
+/*
+ * Runs on a worker thread.  Fills in everything past `path`.
+ */
+ALboolean load_track(track* t)
+{
+    const wave_file* wave = &t->wave;
+    register ALsizei i;
+
+    if (open_wave(&t->wave, t->path) == AL_FALSE)
+        return AL_FALSE;
+    if (wave->format == AL_NONE || wave->frames == 0)
+    {
+        printf("Unsupported WAVE format in \"%s\".\n", t->path);
+        return AL_FALSE;
+    }
+    t->frame_size = format_frame_size(wave->pcm_format);
+    touch_pages(wave->data, wave->size);
+    if (t->preroll_frames > wave->frames)
+        t->preroll_frames = wave->frames;
+    if (wave->format == wave->pcm_format)
+    { /* The mapping itself is the pre-roll, now that it is paged in. */
+        t->preroll = wave->data;
+        return AL_TRUE;
+    }
+
+/*
+ * Pre-roll whole ADPCM blocks, so that carrying on from the decoder after
+ * them never has to decode a block twice, but no more than fit in a block
+ * of the PCM arena.
+ */
+    if (open_adpcm_reader(&t->decoder, wave) == AL_FALSE)
+        return AL_FALSE;
+    t->preroll_frames += wave->block_frames - 1;
+    t->preroll_frames -= t->preroll_frames % wave->block_frames;
+    while (t->preroll_frames > wave->block_frames && pcm_arena.base != NULL
+        && t->preroll_frames * t->frame_size > pcm_arena.block_size)
+        t->preroll_frames -= wave->block_frames;
+    if (t->preroll_frames > wave->frames)
+        t->preroll_frames = wave->frames;
+    t->preroll_memory = (ALubyte *)pcm_alloc(
+        t->preroll_frames * t->frame_size);
+    if (t->preroll_memory == NULL)
+    {
+        printf("Failed to allocate pre-roll memory for \"%s\".\n", t->path);
+        return AL_FALSE;
+    }
+    for (i = 0; i < t->preroll_frames / wave->block_frames; i++)
+        decode_adpcm_block(&t->decoder, (ALshort *)t->preroll_memory
+            + i * wave->block_frames * wave->channels, i);
+    t->preroll = t->preroll_memory;
+    seek_adpcm(&t->decoder, t->preroll_frames);
+    return AL_TRUE;
+}
+
+/*
+ * The owner's newest request, else the oldest request of anyone else.
+ */
+track* take_job(load_deque* own)
+{
+    load_pool* pool = own->pool;
+    track* job = NULL;
+    register ALsizei i;
+
+    EnterCriticalSection(&own->lock);
+    if (own->tail != own->head)
+        job = own->jobs[--own->tail % LOAD_DEQUE_SIZE];
+    LeaveCriticalSection(&own->lock);
+    for (i = 1; job == NULL && i < pool->workers; i++)
+    {
+        load_deque* victim = &pool->deques[
+            (own - pool->deques + i) % pool->workers];
+
+        EnterCriticalSection(&victim->lock);
+        if (victim->tail != victim->head)
+            job = victim->jobs[victim->head++ % LOAD_DEQUE_SIZE];
+        LeaveCriticalSection(&victim->lock);
+        if (job != NULL)
+            InterlockedIncrement(&pool->steals);
+    }
+    return (job);
+}
+
+void finish_job(track* job, ALboolean loaded)
+{
+    InterlockedExchange(&job->state, loaded ? TRACK_READY : TRACK_FAILED);
+    SetEvent(job->done);
+    return;
+}
+
+DWORD WINAPI load_worker_main(LPVOID param)
+{
+    load_deque* own = (load_deque *)param;
+    load_pool* pool = own->pool;
+
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    for (;;)
+    {
+        track* job;
+
+        WaitForSingleObject(pool->work, INFINITE);
+        if (pool->quit)
+            break;
+/*
+ * Every count on the semaphore stands for one request, and a request only
+ * leaves a deque by its count being taken, so there is always a job to find;
+ * if another worker got to it first, ours is still sitting elsewhere.
+ */
+        while ((job = take_job(own)) == NULL)
+            SwitchToThread();
+        if (load_track(job))
+            InterlockedIncrement(&pool->loads);
+        else
+        {
+            InterlockedIncrement(&pool->failures);
+            finish_job(job, AL_FALSE);
+            continue;
+        }
+        finish_job(job, AL_TRUE);
+    }
+    flush_block_cache(&pcm_arena);
+    return 0;
+}
+
+/*
+ * `workers` of 0 picks one fewer than the count of processors.
+ */
+ALboolean open_load_pool(load_pool* pool, ALsizei workers)
+{
+    SYSTEM_INFO system;
+    register ALsizei i;
+
+    memset(pool, 0, sizeof(load_pool));
+    if (workers <= 0)
+    {
+        GetSystemInfo(&system);
+        workers = (ALsizei)system.dwNumberOfProcessors - 1;
+    }
+    if (workers < 1)
+        workers = 1;
+    if (workers > MAX_LOAD_WORKERS)
+        workers = MAX_LOAD_WORKERS;
+    pool->work = CreateSemaphore(NULL, 0, MAX_LOAD_WORKERS * LOAD_DEQUE_SIZE,
+        NULL);
+    if (pool->work == NULL)
+    {
+        printf("Failed to create the loader semaphore.\n");
+        return AL_FALSE;
+    }
+    for (i = 0; i < workers; i++)
+    {
+        InitializeCriticalSection(&pool->deques[i].lock);
+        pool->deques[i].pool = pool;
+    }
+    pool->workers = workers;
+    for (i = 0; i < workers; i++)
+    {
+        pool->threads[i] = CreateThread(NULL, 0, load_worker_main,
+            &pool->deques[i], 0, NULL);
+        if (pool->threads[i] == NULL)
+        {
+            printf("Failed to start loader thread %i.\n", i);
+            return AL_FALSE;
+        }
+    }
+    return AL_TRUE;
+}
+
+/*
+ * Queue `path` for loading with `preroll_frames` ready to play up front.
+ * Returns NULL only if the request could not even be queued.
+ */
+track* request_track(load_pool* pool, const char* path,
+    ALsizei preroll_frames)
+{
+    track* t;
+    register ALsizei i;
+
+    t = (track *)calloc(1, sizeof(track));
+    if (t == NULL)
+    {
+        printf("Failed to allocate a track for \"%s\".\n", path);
+        return NULL;
+    }
+    strncpy(t->path, path, MAX_PATH - 1);
+    t->preroll_frames = preroll_frames;
+    t->state = TRACK_PENDING;
+    t->wave.file = INVALID_HANDLE_VALUE;
+    t->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (t->done == NULL)
+    {
+        free(t);
+        return NULL;
+    }
+    for (i = 0; i < pool->workers; i++)
+    {
+        load_deque* deque = &pool->deques[
+            pool->next_deque++ % pool->workers];
+        ALboolean queued = AL_FALSE;
+
+        EnterCriticalSection(&deque->lock);
+        if (deque->tail - deque->head < LOAD_DEQUE_SIZE)
+        {
+            deque->jobs[deque->tail++ % LOAD_DEQUE_SIZE] = t;
+            queued = AL_TRUE;
+        }
+        LeaveCriticalSection(&deque->lock);
+        if (queued)
+        {
+            ReleaseSemaphore(pool->work, 1, NULL);
+            return (t);
+        }
+    }
+    printf("Too many loads in flight; \"%s\" refused.\n", path);
+    CloseHandle(t->done);
+    free(t);
+    return NULL;
+}
+
+LONG track_state(const track* t)
+{
+    return (t->state);
+}
+
+/*
+ * Block for up to `ms` milliseconds.  Returns the TRACK_* state.
+ */
+LONG wait_track(track* t, DWORD ms)
+{
+    WaitForSingleObject(t->done, ms);
+    return (t->state);
+}
+
+/*
+ * Waits out a load still in flight, so never call it on the play path.
+ */
+void release_track(track* t)
+{
+    if (t == NULL)
+        return;
+    WaitForSingleObject(t->done, INFINITE);
+    CloseHandle(t->done);
+    close_adpcm_reader(&t->decoder);
+    pcm_free(t->preroll_memory);
+    close_wave(&t->wave);
+    free(t);
+    return;
+}
+
+/*
+ * Requests nobody has started on yet fail right away.
+ */
+void close_load_pool(load_pool* pool)
+{
+    register ALsizei i;
+
+    InterlockedExchange(&pool->quit, 1);
+    ReleaseSemaphore(pool->work, pool->workers, NULL);
+    for (i = 0; i < pool->workers; i++)
+        if (pool->threads[i] != NULL)
+        {
+            WaitForSingleObject(pool->threads[i], INFINITE);
+            CloseHandle(pool->threads[i]);
+        }
+    for (i = 0; i < pool->workers; i++)
+    {
+        load_deque* deque = &pool->deques[i];
+
+        while (deque->tail != deque->head)
+            finish_job(deque->jobs[deque->head++ % LOAD_DEQUE_SIZE],
+                AL_FALSE);
+        DeleteCriticalSection(&deque->lock);
+    }
+    CloseHandle(pool->work);
+    pool->workers = 0;
+    return;
+}
+
+void log_load_pool(const load_pool* pool)
+{
+    printf("Loader:  %i threads, %li tracks loaded (%li stolen), "
+        "%li failed\n", pool->workers, pool->loads, pool->steals,
+        pool->failures);
+    return;
+}
+
+/*
+ * Hand out up to `frames` frames of `t` in place:  the pre-roll first, then
+ * the mapping or the decoder.  Returns 0 once the track has played out.
+ */
+ALsizei peek_track(track* t, const ALvoid** data, ALsizei frames)
+{
+    ALsizei count;
+
+    if (t->position < t->preroll_frames)
+    {
+        count = t->preroll_frames - t->position;
+        if (count > frames)
+            count = frames;
+        *data = t->preroll + t->position * t->frame_size;
+    }
+    else
+    {
+        count = t->wave.frames - t->position;
+        if (count > frames)
+            count = frames;
+        if (count <= 0)
+            return 0;
+        if (t->wave.format == t->wave.pcm_format)
+            *data = t->wave.data + t->position * t->frame_size;
+        else
+            count = peek_adpcm(&t->decoder, data, count);
+    }
+    t->position += count;
+    return (count);
+}
+
+/*
+ * Carry on from sample frame `frame`; 0 starts the track over.
+ */
+void seek_track(track* t, ALsizei frame)
+{
+    if (frame < 0 || frame >= t->wave.frames)
+        frame = 0;
+    t->position = frame;
+    if (t->wave.format != t->wave.pcm_format)
+        seek_adpcm(&t->decoder, (frame > t->preroll_frames)
+            ? frame : t->preroll_frames);
+    return;
+}
+
+/*
+ * Tracks played back to back.  Only the thread filling the stream touches
+ * `current`; other threads hand it the next track through queue_track() and
+ * take back played-out tracks with reap_playlist().
+ */
+typedef struct {
+    track* current;
+    track* volatile next; /* to follow `current`, once loaded */
+    track* volatile finished; /* retired tracks, pushed by the fill thread */
+    ALenum format; /* what every track must decode to */
+    ALsizei frequency;
+
+    ALuint switches; /* gapless changes of track */
+    ALuint repeats; /* times `current` started over with nothing to follow */
+    ALuint late; /* of those, times the next track was still loading */
+    ALuint rejected; /* next tracks that failed or did not match */
+} playlist;
+
+void open_playlist(playlist* list, track* first)
+{
+    memset(list, 0, sizeof(playlist));
+    list->current = first;
+    list->format = first->wave.pcm_format;
+    list->frequency = first->wave.frequency;
+    return;
+}
+
+void retire_track(playlist* list, track* t)
+{
+    track* head;
+
+    do {
+        head = list->finished;
+        t->retired = head;
+    } while (InterlockedCompareExchangePointer(
+        (PVOID volatile *)&list->finished, t, head) != head);
+    return;
+}
+
+/*
+ * Have `t` follow the current track.  AL_FALSE if one is queued already.
+ */
+ALboolean queue_track(playlist* list, track* t)
+{
+    return InterlockedCompareExchangePointer(
+        (PVOID volatile *)&list->next, t, NULL) == NULL;
+}
+
+/*
+ * The current track has played out.  Move on to the next one if it is
+ * ready, or else start the current one over, as the test sound always has.
+ */
+void advance_playlist(playlist* list)
+{
+    track* next = list->next;
+
+    if (next != NULL && track_state(next) != TRACK_PENDING)
+    {
+        InterlockedExchangePointer((PVOID volatile *)&list->next, NULL);
+        if (track_state(next) == TRACK_READY
+         && next->wave.pcm_format == list->format
+         && next->wave.frequency == list->frequency)
+        {
+            retire_track(list, list->current);
+            list->current = next;
+            seek_track(next, 0);
+            ++list->switches;
+            return;
+        }
+        retire_track(list, next);
+        ++list->rejected;
+    }
+    else if (next != NULL)
+        ++list->late;
+    seek_track(list->current, 0);
+    ++list->repeats;
+    return;
+}
+
+ALsizei peek_playlist(ALvoid* user, const ALvoid** data, ALsizei frames)
+{
+    playlist* list = (playlist *)user;
+    ALsizei count;
+
+    count = peek_track(list->current, data, frames);
+    if (count > 0)
+        return (count);
+    advance_playlist(list);
+    return peek_track(list->current, data, frames);
+}
+
+ALsizei fill_playlist(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    playlist* list = (playlist *)user;
+    ALubyte* out = (ALubyte *)data;
+    ALsizei left = frames;
+
+    while (left > 0)
+    {
+        const ALsizei frame_size = list->current->frame_size;
+        const ALvoid* in;
+        const ALsizei count = peek_playlist(list, &in, left);
+
+        if (count <= 0)
+            break;
+        memcpy(out, in, count * frame_size);
+        out += count * frame_size;
+        left -= count;
+    }
+    return (frames - left);
+}
+
+/*
+ * Release the tracks the fill thread is done with, off the play path.
+ */
+void reap_playlist(playlist* list)
+{
+    track* t;
+
+    t = (track *)InterlockedExchangePointer(
+        (PVOID volatile *)&list->finished, NULL);
+    while (t != NULL)
+    {
+        track* retired = t->retired;
+
+        release_track(t);
+        t = retired;
+    }
+    return;
+}
+
+void close_playlist(playlist* list)
+{
+    reap_playlist(list);
+    release_track(list->next);
+    release_track(list->current);
+    list->next = NULL;
+    list->current = NULL;
+    return;
+}
+
+void log_playlist(const playlist* list)
+{
+    printf("Playlist:  %u gapless switches, %u repeats (%u waiting on a "
+        "load), %u tracks rejected\n", list->switches, list->repeats,
+        list->late, list->rejected);
+    return;
+}
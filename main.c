@@ -1,26 +1,48 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <conio.h>
 #include <Windows.h>
 
 #include <al/al.h>
 #include <al/alc.h>
-#include <al/alut.h>
+#include <al/alext.h>
 #include <al/xram.h>
 
+/*
+ * Must come before anything making AL calls; see NDEBUG in there.
+ */
+#include "trace.h"
+
 /*
  * Debugging, extra features, run-time user manipulations of OpenAL, etc.
  */
+#include "caps.h"
 #include "stuff.h"
+#include "convert.h"
+#include "metrics.h"
+#include "arena.h"
+#include "stream.h"
+#include "events.h"
+#include "tune.h"
+#include "ring.h"
+#include "wave.h"
+#include "adpcm.h"
+#include "loader.h"
+#include "mixbus.h"
+#include "resample.h"
+#include "bench.h"
+#include "sessions.h"
+#include "voices.h"
+#include "cache.h"
+#include "batch.h"
+#include "scene.h"
+#include "plugin.h"
+#include "render.h"
+#include "stress.h"
 
-const char* AL_errors[6] = {
-    "AL_NO_ERROR", /* There is no current error. */
-    "AL_INVALID_NAME", /* Invalid name parameter. */
-    "AL_INVALID_ENUM", /* Invalid parameter. */
-    "AL_INVALID_VALUE", /* Invalid enum parameter value. */
-    "AL_INVALID_OPERATION", /* Illegal call. */
-    "AL_OUT_OF_MEMORY" /* Unable to allocate memory. */
-};
 
 #define AT_X    ( 0.0F)
 #define AT_Y    ( 0.0F)
@@ -37,19 +59,21 @@ ALboolean initialize_listener(void)
 
     ALstatus = alGetError();
     if (ALstatus != AL_NO_ERROR)
-        printf("alListener\n%s\n\n", AL_errors[ALstatus]);
+        printf("alListener\n%s\n\n", AL_error_string(ALstatus));
 
 /*
  * Demonstrate the common attributes by starting with OpenAL 1.1 defaults.
  * These three parameters are also valid for dynamic source objects.
  */
+    begin_updates(); /* The mixer sees the listener once, fully set. */
     alListener3f(AL_POSITION, 0.0f, 0.0f, 0.0f);
     alListener3f(AL_VELOCITY, 0.0f, 0.0f, 0.0f);
     alListenerf(AL_GAIN, 1.0F); /* This overrides alSourcef(src, AL_GAIN...). */
     ALstatus = alGetError();
     if (ALstatus != AL_NO_ERROR)
     {
-        printf("alListener\n%s\n\n", AL_errors[ALstatus]);
+        printf("alListener\n%s\n\n", AL_error_string(ALstatus));
+        end_updates();
         return AL_FALSE;
     }
 
@@ -58,33 +82,36 @@ ALboolean initialize_listener(void)
  * You cannot set this for sources.  (The sound card's DSP should do a NOP.)
  */
     alListenerfv(AL_ORIENTATION, ori);
+    end_updates();
     ALstatus = alGetError();
     if (ALstatus != AL_NO_ERROR)
     {
-        printf("alListener\n%s\n\n", AL_errors[ALstatus]);
+        printf("alListener\n%s\n\n", AL_error_string(ALstatus));
         return AL_FALSE;
     }
     return AL_TRUE;
 }
 
+/*
+ * Convert every buffer upload to 32-bit float samples (AL_EXT_FLOAT32)?
+ */
+ALboolean upload_float = AL_FALSE;
+
 ALboolean initialize_buffer(void)
 {
     ALenum ALstatus;
-    ALenum format;
-    ALsizei size;
-    ALvoid* data;
-    ALsizei freq;
-    ALboolean loop;
+    wave_file wave;
+    ALboolean uploaded;
 
     ALstatus = alGetError();
     if (ALstatus != AL_NO_ERROR)
-        printf("alBuffer\n%s\n\n", AL_errors[ALstatus]);
+        printf("alBuffer\n%s\n\n", AL_error_string(ALstatus));
 
     alGenBuffers(NUM_BUFFERS, &buffer);
     ALstatus = alGetError();
     if (ALstatus != AL_NO_ERROR)
     {
-        printf("alBuffer\n%s\n\n", AL_errors[ALstatus]);
+        printf("alBuffer\n%s\n\n", AL_error_string(ALstatus));
         return AL_FALSE;
     }
     if (alIsBuffer(buffer) == AL_FALSE)
@@ -93,16 +120,69 @@ ALboolean initialize_buffer(void)
         return AL_FALSE;
     }
 
-    alutLoadWAVFile((ALbyte *)"test.wav", &format, &data, &size, &freq, &loop);
-    alBufferData(buffer, format, data, size, freq);
-    alutUnloadWAV(format, data, size, freq);
+    if (open_wave(&wave, "test.wav") == AL_FALSE)
+        return AL_FALSE;
+    if (wave.format == AL_NONE)
+    {
+        printf("Unsupported WAVE format:  %i channels, %i bits, tag 0x%04X\n",
+            wave.channels, wave.bits, wave.format_tag);
+        close_wave(&wave);
+        return AL_FALSE;
+    }
+    uploaded = upload_wave(buffer, &wave, upload_float);
+    close_wave(&wave); /* AL has its own copy now. */
+    return (uploaded);
+}
+
+/*
+ * Put a source into the OpenAL 1.1 default state, spelling out every
+ * attribute.  Also used on each of the many sources of the benchmarks.
+ */
+ALboolean setup_source(ALuint src)
+{
+    ALenum ALstatus;
+    ALint query;
+
+    begin_updates(); /* about twenty attributes, recalculated once */
+    alSource3f(src, AL_POSITION, 0.0F, 0.0F, 0.0F);
+    alSource3f(src, AL_VELOCITY, 0.0F, 0.0F, 0.0F);
+    alSourcef(src, AL_GAIN, 1.0F);
+
+/*
+ * The following are specific to the sources only.
+ * You cannot apply these attributes to the listener.
+ */
+    alSourcei(src, AL_SOURCE_RELATIVE, AL_FALSE);
+    alGetSourcei(src, AL_SOURCE_TYPE, &query); /* READ-ONLY */
+    alSourcei(src, AL_LOOPING, AL_FALSE);
+    alSourcei(src, AL_BUFFER, AL_NONE);
+    alGetSourcei(src, AL_BUFFERS_QUEUED, &query); /* READ-ONLY */
+    alGetSourcei(src, AL_BUFFERS_PROCESSED, &query); /* READ-ONLY */
+    alSourcef(src, AL_MIN_GAIN, 0.0F);
+    alSourcef(src, AL_MAX_GAIN, 1.0F);
+    alSourcef(src, AL_REFERENCE_DISTANCE, 1.0F);
+    alSourcef(src, AL_ROLLOFF_FACTOR, 1.0F);
+ /* alSourcei(src, AL_MAX_DISTANCE, MAX_FLOAT); */
+    alSourcef(src, AL_PITCH, 1.0F);
+    alSource3f(src, AL_DIRECTION, 0.0F, 0.0F, 0.0F);
+    alSourcef(src, AL_CONE_INNER_ANGLE, +360.0F);
+    alSourcef(src, AL_CONE_OUTER_ANGLE, +360.0F);
+    alSourcef(src, AL_SEC_OFFSET, 0.0F);
+    alSourcef(src, AL_SAMPLE_OFFSET, 0.0F);
+    alSourcef(src, AL_BYTE_OFFSET, 0.0F);
+    end_updates();
+    ALstatus = alGetError();
+    if (ALstatus != AL_NO_ERROR)
+    {
+        printf("alSource\n%s\n\n", AL_error_string(ALstatus));
+        return AL_FALSE;
+    }
     return AL_TRUE;
 }
 
 ALboolean initialize_source(void)
 {
     ALenum ALstatus;
-    ALint query;
 
     ALstatus = alGetError(); /* Each error check zeroes error status. */
     if (ALstatus != AL_NO_ERROR)
@@ -112,7 +192,7 @@ ALboolean initialize_source(void)
     ALstatus = alGetError();
     if (ALstatus != AL_NO_ERROR)
     {
-        printf("alSource\n%s\n\n", AL_errors[ALstatus]);
+        printf("alSource\n%s\n\n", AL_error_string(ALstatus));
         return AL_FALSE;
     }
     if (alIsSource(source) == AL_FALSE)
@@ -120,57 +200,405 @@ ALboolean initialize_source(void)
         printf("Failed to validate source.\n");
         return AL_FALSE;
     }
-    alSource3f(source, AL_POSITION, 0.0F, 0.0F, 0.0F);
-    alSource3f(source, AL_VELOCITY, 0.0F, 0.0F, 0.0F);
-    alSourcef(source, AL_GAIN, 1.0F);
+    return setup_source(source);
+}
 
 /*
- * The following are specific to the sources only.
- * You cannot apply these attributes to the listener.
+ * Run-time options.  Streaming mode cycles `queue_depth` buffers of
+ * `buffer_frames` sample frames each through the source instead of looping
+ * the single static buffer.
  */
-    alSourcei(source, AL_SOURCE_RELATIVE, AL_FALSE);
-    alGetSourcei(source, AL_SOURCE_TYPE, &query); /* READ-ONLY */
-    alSourcei(source, AL_LOOPING, AL_FALSE);
-    alSourcei(source, AL_BUFFER, AL_NONE);
-    alGetSourcei(source, AL_BUFFERS_QUEUED, &query); /* READ-ONLY */
-    alGetSourcei(source, AL_BUFFERS_PROCESSED, &query); /* READ-ONLY */
-    alSourcef(source, AL_MIN_GAIN, 0.0F);
-    alSourcef(source, AL_MAX_GAIN, 1.0F);
-    alSourcef(source, AL_REFERENCE_DISTANCE, 1.0F);
-    alSourcef(source, AL_ROLLOFF_FACTOR, 1.0F);
- /* alSourcei(source, AL_MAX_DISTANCE, MAX_FLOAT); */
-    alSourcef(source, AL_PITCH, 1.0F);
-    alSource3f(source, AL_DIRECTION, 0.0F, 0.0F, 0.0F);
-    alSourcef(source, AL_CONE_INNER_ANGLE, +360.0F);
-    alSourcef(source, AL_CONE_OUTER_ANGLE, +360.0F);
-    alSourcef(source, AL_SEC_OFFSET, 0.0F);
-    alSourcef(source, AL_SAMPLE_OFFSET, 0.0F);
-    alSourcef(source, AL_BYTE_OFFSET, 0.0F);
-    ALstatus = alGetError();
-    if (ALstatus != AL_NO_ERROR)
+ALboolean streaming = AL_FALSE;
+ALboolean threaded = AL_FALSE;
+ALboolean pulling = AL_FALSE;
+ALboolean mapping = AL_FALSE; /* write into mapped AL buffers */
+ALboolean resampling = AL_FALSE;
+ALboolean benchmark = AL_FALSE;
+ALsizei parallel_sessions = 0; /* most loopback sessions to run at once */
+ALsizei stress_threads = 0; /* threads firing random state transitions */
+ALboolean plugin_demo = AL_FALSE;
+const char* render_script = NULL; /* offline render instead of playback */
+const char* render_golden = NULL;
+ALint render_tolerance = 0;
+int resample_quality = RESAMPLE_SINC;
+ALsizei queue_depth = 4;
+ALsizei buffer_frames = BUFFER_SIZE;
+ALsizei pool_voices = 0;
+DWORD metrics_period = 0; /* milliseconds between METRICS.CSV rows */
+ALsizei cache_budget = 16 << 20; /* bytes of decoded effects to keep */
+ALsizei mix_streams = 0; /* copies of the stream summed on the mix bus */
+ALboolean adaptive = AL_FALSE; /* let tune.h resize the queue */
+ALsizei scene_emitters = 0; /* looping copies of the effect to cull */
+
+void parse_command_line(int argc, char* argv[])
+{
+    register int i;
+
+    for (i = 1; i < argc; i++)
     {
-        printf("alSource\n%s\n\n", AL_errors[ALstatus]);
+        if (strcmp(argv[i], "-s") == 0)
+            streaming = AL_TRUE;
+        else if (strcmp(argv[i], "-t") == 0)
+            streaming = threaded = AL_TRUE;
+        else if (strcmp(argv[i], "-p") == 0)
+            streaming = pulling = AL_TRUE;
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            streaming = resampling = AL_TRUE;
+            ++i;
+            if (strcmp(argv[i], "linear") == 0)
+                resample_quality = RESAMPLE_LINEAR;
+            else if (strcmp(argv[i], "cubic") == 0)
+                resample_quality = RESAMPLE_CUBIC;
+            else
+                resample_quality = RESAMPLE_SINC;
+        }
+        else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc)
+            pool_voices = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc)
+            scene_emitters = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            metrics_period = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            cache_budget = atoi(argv[++i]) << 10;
+        else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+        {
+            streaming = AL_TRUE;
+            mix_streams = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-a") == 0)
+            streaming = adaptive = AL_TRUE;
+        else if (strcmp(argv[i], "-bench") == 0)
+            benchmark = AL_TRUE;
+        else if (strcmp(argv[i], "-sessions") == 0 && i + 1 < argc)
+            parallel_sessions = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-stress") == 0 && i + 1 < argc)
+            stress_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-plugin") == 0)
+            plugin_demo = AL_TRUE;
+        else if (strcmp(argv[i], "-render") == 0 && i + 1 < argc)
+            render_script = argv[++i];
+        else if (strcmp(argv[i], "-golden") == 0 && i + 1 < argc)
+            render_golden = argv[++i];
+        else if (strcmp(argv[i], "-tolerance") == 0 && i + 1 < argc)
+            render_tolerance = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-map") == 0)
+            streaming = mapping = AL_TRUE;
+        else if (strcmp(argv[i], "-f32") == 0)
+            upload_float = AL_TRUE;
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+            queue_depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            buffer_frames = atoi(argv[++i]);
+        else
+            printf(
+                "Usage:  %s [-s] [-t] [-p] [-map] [-r quality] [-f32] "\
+                "[-q depth] [-b frames] [-a] [-v voices] [-c KiB] "\
+                "[-x streams] [-m ms] [-z emitters] [-bench] [-sessions n] "\
+                "[-stress threads] [-plugin] "\
+                "[-render script [-golden wav] [-tolerance n]]\n"\
+                "    -s:  Stream test.wav through a queue of buffers.\n"\
+                "    -t:  Stream from a producer thread via a sample ring.\n"\
+                "    -p:  Let the mixer pull the stream from a callback.\n"\
+                "  -map:  Write refills straight into mapped AL buffers.\n"\
+                "    -r:  Resample to the device rate (linear, cubic, sinc).\n"\
+                "  -f32:  Upload samples as floats (AL_EXT_FLOAT32).\n"\
+                "    -q:  Count of buffers to queue while streaming.\n"\
+                "    -b:  Sample frames per streaming buffer.\n"\
+                "    -a:  Adapt buffer count and size to avoid underruns.\n"\
+                "    -v:  Pool of voices for one-shot effects (E key).\n"\
+                "    -c:  KiB of decoded effects to keep cached.\n"\
+                "    -x:  Mix this many streams on the CPU into one source.\n"\
+                "    -m:  Log stream metrics to METRICS.CSV every m ms.\n"\
+                "    -z:  Scatter this many emitters on the voice pool.\n"\
+                "-bench:  Time the mixer on a loopback device; no sound.\n"\
+                "-sessions:  Time n loopback devices mixing on n threads.\n"\
+                "-stress:  Time random play/pause/stop/rewind on n threads.\n"\
+                "-plugin:  Play an emulated N64 AI through the plugin API.\n"\
+                "-render:  Render a script of keys to RENDER.WAV offline.\n"\
+                "-golden:  Fail the render if off from this WAVE file by...\n"\
+                "-tolerance:  ...more than n in any sample (default 0).\n\n",
+                argv[0]);
+    }
+    return;
+}
+
+/*
+ * Stand-in for an emulator driving plugin.h:  one AI DMA of a 441 Hz tone
+ * per 60 Hz video frame at 32 kHz, pushed as fast as the sync throttle
+ * lets it, so the pace printed should be 60 frames per second of the
+ * sound card's clock.
+ */
+#define AI_RATE         32000
+#define AI_FRAMES       (AI_RATE / 60)
+
+int run_plugin_demo(void)
+{
+    ALshort dma[2 * AI_FRAMES];
+    ALdouble start;
+    ALuint phase = 0;
+    register int video_frame;
+    register ALsizei i;
+
+    if (audio_open(AI_RATE, SAMPLE_SWAP_HALVES) == AL_FALSE)
+        return 1;
+    audio_sync(100);
+    start = seconds_now();
+    for (video_frame = 1; video_frame <= 10 * 60; video_frame++)
+    {
+        for (i = 0; i < AI_FRAMES; i++, phase++)
+            dma[2*i + 0] = dma[2*i + 1] = (ALshort)(16384
+                * sin(2 * 3.14159265358979323846 * phase * 441 / AI_RATE));
+        converter.swap_halves(dma, dma, 2 * AI_FRAMES); /* as RDRAM has it */
+        audio_push(dma, sizeof(dma));
+        if (video_frame % 60 == 0)
+            printf("%3i s:  %5.1f video frames per second, %u ms latency\n",
+                video_frame / 60, video_frame / (seconds_now() - start),
+                audio_latency_ms());
+    }
+    log_audio_plugin();
+    audio_close();
+    return 0;
+}
+
+/*
+ * Stand-in for an emulator's audio thread:  pushes the looping test sound
+ * into the sample ring at whatever pace there is room for, never blocking.
+ */
+typedef struct {
+    sample_ring* ring;
+    stream_fill fill; /* the test sound, as 16-bit or 8-bit PCM */
+    ALvoid* user;
+    volatile LONG quit;
+} producer_thread;
+
+DWORD WINAPI producer_main(LPVOID param)
+{
+    producer_thread* producer = (producer_thread *)param;
+    sample_ring* ring = producer->ring;
+    ALubyte chunk[BUFFER_SIZE / 10 * 4]; /* 10 ms of 16-bit stereo */
+    const ALsizei frames = sizeof(chunk) / ring->frame_size;
+
+    while (producer->quit == 0)
+    {
+        while (ring_capacity(ring) - ring_fill_level(ring) >= frames)
+        {
+            producer->fill(producer->user, chunk, frames);
+            ring_write(ring, chunk, frames);
+        }
+        Sleep(5);
+    }
+    flush_block_cache(&pcm_arena);
+    return 0;
+}
+
+/*
+ * Stand-in for many streams at once:  `mix_streams` copies of the test
+ * sound, staggered in time and spread from left to right, summed on the mix
+ * bus.  The first input is `tracks` itself, so the N key still works.
+ */
+ALboolean open_mix_streams(mix_bus* bus, playlist* tracks, playlist* extra,
+    load_pool* loader)
+{
+    const ALfloat gain = (ALfloat)(1.0 / sqrt((ALdouble)mix_streams));
+    const ALsizei length = tracks->current->wave.frames;
+    register ALsizei i;
+
+    if (mix_streams > MAX_BUS_INPUTS)
+        mix_streams = MAX_BUS_INPUTS;
+    if (open_mix_bus(bus) == AL_FALSE)
         return AL_FALSE;
+    for (i = 0; i < mix_streams; i++)
+    {
+        const ALfloat pan = (mix_streams > 1)
+            ? -1.0F + 2.0F * i / (mix_streams - 1) : 0.0F;
+        playlist* list = tracks;
+
+        if (i > 0)
+        {
+            track* copy = request_track(loader, "test.wav",
+                queue_depth * buffer_frames);
+
+            if (copy == NULL || wait_track(copy, INFINITE) != TRACK_READY)
+            {
+                release_track(copy);
+                return AL_FALSE;
+            }
+            list = &extra[i - 1];
+            open_playlist(list, copy);
+            seek_track(copy, (ALsizei)((ALdouble)length * i / mix_streams));
+        }
+        if (add_bus_input(bus, fill_playlist, list, list->format, gain,
+                pan) < 0)
+            return AL_FALSE;
     }
     return AL_TRUE;
 }
 
+void close_mix_streams(mix_bus* bus, playlist* extra)
+{
+    register ALsizei i;
+
+    for (i = 1; i < bus->count; i++)
+        close_playlist(&extra[i - 1]);
+    log_mix_bus(bus);
+    close_mix_bus(bus);
+    return;
+}
+
+/*
+ * Writes a row of stream metrics to METRICS.CSV every `period` ms, from a
+ * thread of its own so that file I/O never holds up the refills.  Timings
+ * cover just the period before each row; counters run from the start.
+ */
+typedef struct {
+    AL_stream* stream;
+    stream_metrics* metrics;
+    sample_ring* ring; /* NULL if not threaded */
+    DWORD period;
+    HANDLE stop;
+} metrics_exporter;
+
+DWORD WINAPI exporter_main(LPVOID param)
+{
+    metrics_exporter* exporter = (metrics_exporter *)param;
+    AL_stream* stream = exporter->stream;
+    stream_metrics now, last;
+    const LONGLONG start = ticks_now();
+    FILE* out;
+
+    out = fopen("METRICS.CSV", "w");
+    if (out == NULL)
+    {
+        printf("Unable to write METRICS.CSV.\n");
+        return 1;
+    }
+    fprintf(out, "seconds,refills,underruns,ring_fill,ring_overflows,"
+        "ring_underflows,queued,processed,low_water,sample_offset,"
+        "device_latency_ms,buffered_ms,update_p50_us,update_p99_us,"
+        "update_max_us,upload_p50_us,upload_p99_us,pull_p99_us,"
+        "queue_buffers,buffer_frames\n");
+    memcpy(&last, (const void *)exporter->metrics, sizeof(stream_metrics));
+    while (WaitForSingleObject(exporter->stop, exporter->period)
+        == WAIT_TIMEOUT)
+    {
+        const sample_ring* ring = exporter->ring;
+        ALint queued, processed, offset;
+        ALint64SOFT latency;
+        ALdouble buffered;
+        LONG low;
+
+        memcpy(&now, (const void *)exporter->metrics, sizeof(stream_metrics));
+        low = InterlockedExchange(&exporter->metrics->low_water, -1);
+        alGetSourcei(stream->source, AL_BUFFERS_QUEUED, &queued);
+        alGetSourcei(stream->source, AL_BUFFERS_PROCESSED, &processed);
+        get_source_latency(stream->source, &offset, &latency);
+        buffered = stream->pull ? 0
+          : 1000.0 * (queued * stream->chunk - offset) / stream->frequency;
+        buffered += latency / 1e6;
+
+        fprintf(out, "%.3f,%u,%u,%i,%u,%u,%i,%i,%li,%i,%.3f,%.3f,"
+            "%li,%li,%li,%li,%li,%li,%i,%i\n",
+            ticks_to_seconds(ticks_now() - start),
+            stream->refills, stream->underruns,
+            ring ? ring_fill_level(ring) : 0,
+            ring ? ring->overflows : 0, ring ? ring->underflows : 0,
+            queued, processed, low, offset, latency / 1e6, buffered,
+            histogram_percentile(&now.update, &last.update, 50),
+            histogram_percentile(&now.update, &last.update, 99),
+            now.update.max,
+            histogram_percentile(&now.upload, &last.upload, 50),
+            histogram_percentile(&now.upload, &last.upload, 99),
+            histogram_percentile(&now.pull, &last.pull, 99),
+            stream->active, stream->chunk);
+        fflush(out);
+        last = now;
+    }
+    fclose(out);
+    return 0;
+}
+
 const ALCint attrList[] = {
     ALC_FREQUENCY, 44100, /* to-do:  is this a conversion base or absolute? */
     ALC_REFRESH, 60, /* to-do:  20?  check default?  how much? */
     ALC_SYNC, ALC_FALSE, /* to-do:  thread-safe audio with alcProcessContext? */
     ALC_STEREO_SOURCES, NUM_SOURCES,
+    ALC_MONO_SOURCES, MAX_VOICES, /* for the one-shot effect voice pool */
     ALC_INVALID, ALC_INVALID
 };
-int main(void)
+int main(int argc, char* argv[])
 {
     ALboolean success;
     ALCboolean passed;
     ALCdevice* device;
     ALCcontext* context;
+    AL_stream stream;
+    stream_events events;
+    stream_metrics metrics;
+    metrics_exporter exporter;
+    HANDLE exporter_handle = NULL;
+    load_pool loader;
+    playlist tracks;
+    track* first;
+    mix_bus bus;
+    playlist extra[MAX_BUS_INPUTS - 1]; /* inputs of `bus` after `tracks` */
+    stream_fill source_fill; /* `tracks` or `bus`, whichever feeds the rest */
+    ALvoid* source_user;
+    ALenum source_format;
+    sample_ring ring;
+    audio_thread audio;
+    producer_thread producer;
+    HANDLE producer_handle;
+    resampler resampled;
+    voice_pool pool;
+    sound_cache cache;
+    ALint effect_priority = 0;
+    scene world;
+    cached_sound* scenery = NULL; /* the buffer every emitter loops */
+    ALfloat listener_at[3];
+    ALCint device_rate;
+    queue_tuner tuner;
+    ALsizei max_depth, max_frames; /* room for the tuner to grow into */
+    AL_caps caps;
+    HANDLE dumper; /* writing the text dumps, if the snapshot was stale */
 
+    parse_command_line(argc, argv);
+    if (benchmark)
+    {
+        init_converter();
+        return run_benchmarks();
+    }
+    if (plugin_demo)
+        return run_plugin_demo();
+    if (render_script != NULL)
+    {
+        render_job* job = (render_job *)calloc(1, sizeof(render_job));
+        int failed = 1;
+
+        init_converter();
+        if (job != NULL)
+        {
+            job->script = render_script;
+            job->output = "RENDER.WAV";
+            job->golden = render_golden;
+            job->tolerance = render_tolerance;
+            job->streamed = streaming;
+            job->resampled = resampling;
+            job->quality = resample_quality;
+            job->as_float = upload_float;
+            failed = run_render(job);
+        }
+        free(job);
+        return (failed);
+    }
+    if (stress_threads > 0)
+        return run_state_stress(stress_threads);
+    if (parallel_sessions > 0)
+    {
+        init_converter();
+        return run_session_scaling(parallel_sessions);
+    }
     device = init_AL_device();
-    log_AL_device_states(device);
     context = alcCreateContext(device, attrList);
     if (context == NULL)
     {
@@ -184,20 +612,193 @@ int main(void)
         return 0;
     }
 
-    log_AL_states();
-    success = initialize_listener() & initialize_buffer() & initialize_source();
+    log_caps(&caps, get_caps(&caps, device, &dumper));
+    AL_snapshot = &caps;
+    alcGetIntegerv(device, ALC_FREQUENCY, 1, &device_rate);
+    init_converter();
+    printf("Sample conversion:  %s kernels\n", converter.name);
+    load_deferred_updates();
+    if (upload_float && !has_cap(&caps, CAP_EXT_FLOAT32))
+    {
+        printf("No AL_EXT_FLOAT32; keeping integer samples.\n");
+        upload_float = AL_FALSE;
+    }
+    success = initialize_listener() & initialize_source();
+    init_update_batch(&updates);
+    init_source_shadow(&source_state, source);
+    if (!streaming)
+        success &= initialize_buffer();
     if (success == AL_FALSE)
     {
         printf("Fatal error.  Stopping.\n\n");
         return 0;
     }
-    alSourcei(source, AL_BUFFER, buffer);
-    alSourcei(source, AL_LOOPING, AL_TRUE);
-    alSourcef(source, AL_PITCH, 1.0F);
-    alSourceQueueBuffers(source, NUM_BUFFERS, &buffer);
-    log_buffer_attributes();
+    if (streaming)
+    {
+        max_depth = queue_depth;
+        max_frames = buffer_frames;
+        if (adaptive)
+        {
+            max_depth = (2*queue_depth < MAX_QUEUE_DEPTH)
+                ? 2*queue_depth : MAX_QUEUE_DEPTH;
+            max_frames = 2*buffer_frames;
+        }
+        open_block_arena(&pcm_arena, max_frames * 2 * sizeof(ALfloat),
+            ARENA_BLOCKS); /* else pcm_alloc() just calls malloc() */
+/*
+ * Only the first track is waited for; later ones load in the background
+ * and follow it with no gap once ready (the N key).
+ */
+        first = NULL;
+        if (open_load_pool(&loader, 0))
+            first = request_track(&loader, "test.wav",
+                queue_depth * buffer_frames);
+        if (first == NULL || wait_track(first, INFINITE) != TRACK_READY)
+        {
+            printf("Fatal error.  Stopping.\n\n");
+            return 0;
+        }
+        open_playlist(&tracks, first);
+        source_fill = fill_playlist;
+        source_user = &tracks;
+        source_format = tracks.format;
+        if (mix_streams > 0)
+        {
+            success = open_mix_streams(&bus, &tracks, extra, &loader);
+            source_fill = fill_mix_bus;
+            source_user = &bus;
+            source_format = AL_FORMAT_STEREO_FLOAT32;
+        }
+        if (threaded)
+            success &= open_ring(&ring, 2 * max_depth * max_frames,
+                format_frame_size(source_format));
+        if (resampling)
+        { /* The stream gets floats at the device rate from the resampler. */
+            success &= open_resampler(&resampled, resample_quality,
+                source_format, tracks.frequency, device_rate,
+                threaded ? fill_from_ring : source_fill,
+                threaded ? (ALvoid *)&ring : source_user);
+            success &= open_stream(&stream, source,
+                float_format(source_format), device_rate, max_depth,
+                max_frames, fill_resampled, &resampled);
+            success &= convert_stream(&stream, upload_float
+                ? float_format(source_format)
+                : int16_format(source_format), 0);
+        }
+        else if (threaded)
+            success &= open_stream(&stream, source, source_format,
+                tracks.frequency, max_depth, max_frames, fill_from_ring,
+                &ring);
+        else
+        { /* The mapped file goes to alBufferData in place, buffer by buffer. */
+            success &= open_stream(&stream, source, source_format,
+                tracks.frequency, max_depth, max_frames, source_fill,
+                source_user);
+            if (mix_streams == 0)
+                stream.peek = peek_playlist;
+        }
+        if (!resampling && (upload_float || mix_streams > 0))
+            success &= convert_stream(&stream, upload_float
+                ? float_format(source_format)
+                : int16_format(source_format), 0);
+        if (success == AL_FALSE)
+        {
+            printf("Fatal error.  Stopping.\n\n");
+            return 0;
+        }
+        limit_stream(&stream, queue_depth, buffer_frames);
+        if (pulling && pull_stream(&stream) == AL_FALSE)
+            printf("Falling back to the buffer queue.\n");
+        if (mapping && !stream.pull && map_stream(&stream) == AL_FALSE)
+            printf("Falling back to alBufferData.\n");
+        if (open_stream_events(&events, source,
+                1000 * buffer_frames / stream.frequency,
+                1000 / attrList[3]) == AL_FALSE)
+        {
+            printf("Fatal error.  Stopping.\n\n");
+            return 0;
+        }
+        if (metrics_period > 0)
+        {
+            open_stream_metrics(&metrics);
+            stream.metrics = &metrics;
+            load_source_latency();
+        }
+        if (adaptive)
+        {
+            open_queue_tuner(&tuner, &stream);
+            if (metrics_period == 0)
+                load_source_latency();
+        }
+        if (!threaded)
+            update_stream(&stream); /* Prime the queue. */
+        if (threaded)
+        {
+            producer.ring = &ring;
+            producer.fill = source_fill;
+            producer.user = source_user;
+            producer.quit = 0;
+            producer_handle = CreateThread(NULL, 0, producer_main, &producer,
+                0, NULL);
+            start_audio_thread(&audio, &stream, &events,
+                adaptive ? &tuner : NULL);
+        }
+        if (metrics_period > 0)
+        {
+            exporter.stream = &stream;
+            exporter.metrics = &metrics;
+            exporter.ring = threaded ? &ring : NULL;
+            exporter.period = metrics_period;
+            exporter.stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+            exporter_handle = CreateThread(NULL, 0, exporter_main, &exporter,
+                0, NULL);
+        }
+        if (stream.pull)
+            printf("Streaming through a callback buffer the mixer pulls.\n");
+        else
+            printf("Streaming %i buffers of %i frames (%i ms queued).\n",
+                queue_depth, buffer_frames,
+                (int)(1000.0 * queue_depth * buffer_frames / stream.frequency));
+    }
+    else
+    {
+        alSourcei(source, AL_BUFFER, buffer);
+        alSourcei(source, AL_LOOPING, AL_TRUE);
+        alSourcef(source, AL_PITCH, 1.0F);
+        alSourceQueueBuffers(source, NUM_BUFFERS, &buffer);
+        setup_EAX_RAM();
+    }
+
+/*
+ * Effects replay the static buffer, which streaming mode leaves empty.
+ */
+    if (streaming)
+        pool_voices = 0;
+    if (pool_voices > 0 && open_voice_pool(&pool, pool_voices) == AL_FALSE)
+        pool_voices = 0;
+    if (pool_voices > 0)
+        open_sound_cache(&cache, cache_budget, upload_float);
+    if (pool_voices > 0 && scene_emitters > 0)
+        scenery = acquire_sound(&cache, "test.wav");
+    if (scenery != NULL && open_scene(&world, &pool, &updates,
+            scene_emitters) == AL_FALSE)
+    {
+        release_sound(&cache, scenery);
+        scenery = NULL;
+    }
+    if (scenery != NULL)
+    {
+        register ALsizei i;
 
-    setup_EAX_RAM();
+        for (i = 0; i < world.count; i++) /* within 500 m of the origin */
+            place_emitter(&world, i, scenery->buffer, 0,
+                (ALfloat)(rand() % 1001 - 500), 0.0F,
+                (ALfloat)(rand() % 1001 - 500));
+        listener_at[0] = listener_at[1] = listener_at[2] = 0.0F;
+        update_scene(&world, listener_at);
+        log_scene(&world);
+    }
+    log_buffer_attributes(streaming ? stream.buffers[0] : buffer);
     printf(
         "OpenAL test keys:  \n"\
         "\n"\
@@ -207,17 +808,48 @@ int main(void)
         "R) alSourceRewind\n"\
         "F) Shift the pitch (or frequency) by FP coefficient.\n"\
         "V) Re-define the volume coefficient AL_GAIN scale.\n"\
+        "E) Fire test.wav once as an effect from the voice pool (-v)\n"\
+        "Z) Walk the listener 10 m through the scene of emitters (-z)\n"\
+        "N) Queue next.wav (or test.wav) to follow the stream gaplessly\n"\
+        "L) Report how much of the stream is buffered ahead of the mixer\n"\
         "Q) Frees RAM, releases the AL context, and quits\n\n");
 
     do
     {
         ALint query;
+        int key;
+
+/*
+ * getchar() would block until the user hits Enter, starving the queue, so
+ * streaming mode keeps refilling buffers until a key is waiting, sleeping
+ * on stream events and console input in between.
+ */
+        if (streaming && !threaded)
+        {
+            const HANDLE console = GetStdHandle(STD_INPUT_HANDLE);
 
+            while (_kbhit() == 0)
+            {
+                const ALint refilled = update_stream(&stream);
+
+                if (adaptive)
+                    adapt_queue(&tuner, &stream, &events, refilled);
+                reap_playlist(&tracks);
+                drain_console_input(console);
+                wait_stream_event(&events,
+                    next_stream_wait(&events, &stream, refilled), console);
+            }
+            key = _getch();
+        }
         alGetSourcei(source, AL_SOURCE_STATE, &query);
 #if (0)
         DEBUG_SOURCE_STATE(query);
 #endif
-        switch (getchar() & ~0x20) /* lowercase-to-uppercase conversion */
+        if (!streaming || threaded)
+            key = getchar();
+        if (streaming)
+            reap_playlist(&tracks);
+        switch (key & ~0x20) /* lowercase-to-uppercase conversion */
         {
             case 'P':
                 if (query == AL_INITIAL)
@@ -227,12 +859,16 @@ int main(void)
                     printf("from %s to %s to %s\n", "AL_STOPPED",
                         "AL_INITIAL", "AL_PLAYING");
                 alSourcePlay(source);
+                stream.playing = AL_TRUE;
+                if (streaming)
+                    wake_stream(&events);
                 continue;
             case 'H':
                 if (query == AL_PLAYING)
                     printf("from %s to %s\n", "AL_PLAYING", "AL_PAUSED");
                 else
                     printf("NOP\n"); /* no errors, action or state change */
+                stream.playing = AL_FALSE;
                 alSourcePause(source);
                 continue;
             case 'S':
@@ -242,6 +878,7 @@ int main(void)
                     printf("from %s to %s\n", "AL_PLAYING", "AL_STOPPED");
                 if (query == AL_PAUSED)
                     printf("from %s to %s\n", "AL_PAUSED", "AL_STOPPED");
+                stream.playing = AL_FALSE;
                 alSourceStop(source);
                 continue;
             case 'R':
@@ -254,6 +891,7 @@ int main(void)
                     printf("from %s to %s\n", "AL_PAUSED", "AL_INITIAL");
                 if (query == AL_STOPPED)
                     printf("from %s to %s\n", "AL_STOPPED", "AL_INITIAL");
+                stream.playing = AL_FALSE;
                 alSourceRewind(source);
                 continue;
             case 'F': { /* Accelerate/decelerate frequency by multiplier. */
@@ -261,7 +899,14 @@ int main(void)
 
                 printf("Enter pitch shift coefficient:  ");
                 scanf("%f", &period);
-                alSourcef(source, AL_PITCH, period);
+                if (resampling) /* no AL_PITCH:  read the input faster */
+                    request_resample_rate(&resampled,
+                        tracks.frequency * period);
+                else
+                {
+                    batch_sourcef(&updates, &source_state, AL_PITCH, period);
+                    commit_updates(&updates);
+                }
                 continue;
             }
             case 'V': {
@@ -271,14 +916,141 @@ int main(void)
                 scanf("%f", &gain);
                 change_volume(gain);
                 continue; }
+            case 'E': { /* priorities cycle 0 to 3 to exercise stealing */
+                cached_sound* effect;
+
+                if (pool_voices == 0)
+                {
+                    printf("No voice pool; run with -v and without -s.\n");
+                    continue;
+                }
+                effect = acquire_sound(&cache, "test.wav");
+                if (effect == NULL)
+                    continue;
+                if (play_sound(&pool, &cache, effect, 1.0F,
+                        effect_priority) == 0)
+                    printf("All voices outrank priority %i.\n",
+                        effect_priority);
+                effect_priority = (effect_priority + 1) & 3;
+                log_voice_pool(&pool);
+                log_sound_cache(&cache);
+                continue; }
+            case 'Z':
+                if (scenery == NULL)
+                {
+                    printf("No scene; run with -v and -z, without -s.\n");
+                    continue;
+                }
+                listener_at[0] += 10.0F;
+                update_scene(&world, listener_at);
+                log_scene(&world);
+                log_voice_pool(&pool);
+                log_update_batch(&updates);
+                continue;
+            case 'L': { /* end-to-end:  producer ring, then the AL queue */
+                ALsizei frames;
+
+                if (!streaming)
+                {
+                    printf("Nothing is streaming; run with -s, -t or -p.\n");
+                    continue;
+                }
+                frames = stream_latency_frames(&stream);
+                printf("Buffered:  %.1f ms in AL (%s)",
+                    1000.0 * frames / stream.frequency,
+                    stream.pull ? "pull" : "push");
+                if (threaded)
+                    printf(" + %.1f ms in the sample ring",
+                        1000.0 * ring_fill_level(&ring) / tracks.frequency);
+                printf("\n");
+                continue; }
+            case 'N': { /* loads in the background; plays when this one ends */
+                const char* path = "test.wav";
+                track* next;
+
+                if (!streaming)
+                {
+                    printf("Nothing is streaming; run with -s, -t or -p.\n");
+                    continue;
+                }
+                if (tracks.next != NULL)
+                {
+                    printf("A track is queued already.\n");
+                    continue;
+                }
+                if (GetFileAttributes("next.wav") != INVALID_FILE_ATTRIBUTES)
+                    path = "next.wav";
+                next = request_track(&loader, path,
+                    queue_depth * buffer_frames);
+                if (next != NULL && queue_track(&tracks, next) == AL_FALSE)
+                    release_track(next);
+                if (next != NULL)
+                    printf("Queued \"%s\".\n", path);
+                continue; }
             case 'Q':
                 goto EXIT;
         };
     } while (success == success);
 EXIT:
-    alSourceUnqueueBuffers(source, NUM_BUFFERS, &buffer);
+    if (exporter_handle != NULL)
+    {
+        SetEvent(exporter.stop);
+        WaitForSingleObject(exporter_handle, INFINITE);
+        CloseHandle(exporter_handle);
+        CloseHandle(exporter.stop);
+    }
+    if (threaded)
+    {
+        InterlockedExchange(&producer.quit, 1);
+        WaitForSingleObject(producer_handle, INFINITE);
+        CloseHandle(producer_handle);
+        stop_audio_thread(&audio);
+        log_ring_counters(&ring);
+        close_ring(&ring);
+    }
+    if (streaming)
+    {
+        printf("Stream:  %u refills, %u underruns\n",
+            stream.refills, stream.underruns);
+        if (adaptive)
+            log_queue_tuner(&tuner, &stream);
+        log_stream_events(&events);
+        close_stream_events(&events);
+        close_stream(&stream);
+        if (resampling)
+            close_resampler(&resampled);
+        if (mix_streams > 0)
+            close_mix_streams(&bus, extra);
+        log_playlist(&tracks);
+        close_playlist(&tracks);
+        log_load_pool(&loader);
+        close_load_pool(&loader);
+        log_block_arena(&pcm_arena);
+        close_block_arena(&pcm_arena);
+    }
+    else
+        alSourceUnqueueBuffers(source, NUM_BUFFERS, &buffer);
+    if (scenery != NULL)
+    {
+        log_scene(&world);
+        close_scene(&world);
+        release_sound(&cache, scenery);
+    }
+    if (pool_voices > 0)
+    {
+        close_voice_pool(&pool); /* before the buffers they may still hold */
+        close_sound_cache(&cache);
+    }
+    log_update_batch(&updates);
+    if (dumper != NULL)
+    {
+        WaitForSingleObject(dumper, INFINITE);
+        CloseHandle(dumper);
+    }
+    AL_snapshot = NULL;
     passed = finish_AL_context();
     if (passed == ALC_FALSE)
         printf("Failed to invalidate current ALC.\n");
+    dump_AL_trace();
     return 0;
 }
@@ -0,0 +1,124 @@
+/*
+ * Run-time instrumentation of the streaming path.
+ *
+ * Timings go into histograms of power-of-two microsecond buckets.  Every
+ * bucket is a LONG bumped with InterlockedIncrement, so the audio thread,
+ * the mixer's callback thread and the exporter never take a lock, and the
+ * cost of one sample is two QueryPerformanceCounter calls and one atomic
+ * add.  Histograms only ever grow; whoever reads them keeps the previous
+ * snapshot and takes the difference to see one interval at a time.
+ */
+#define HISTOGRAM_BUCKETS       32
+
+typedef struct {
+    volatile LONG count[HISTOGRAM_BUCKETS]; /* bucket i:  under 2^(i+1) - 1 */
+    volatile LONG max;
+} histogram;
+
+typedef struct {
+    histogram update; /* one update_stream(), in microseconds */
+    histogram upload; /* one conversion plus alBufferData */
+    histogram pull; /* one mixer callback, in pull mode */
+    volatile LONG low_water; /* fewest buffers left queued, -1 if unseen */
+} stream_metrics;
+
+void open_stream_metrics(stream_metrics* metrics)
+{
+    memset(metrics, 0, sizeof(stream_metrics));
+    metrics->low_water = -1;
+    return;
+}
+
+/*
+ * Note how far the queue had drained when an update came to refill it.
+ * Only the refill thread writes; the exporter swaps it back to -1.
+ */
+void record_low_water(stream_metrics* metrics, LONG queued)
+{
+    const LONG low = metrics->low_water;
+
+    if (low < 0 || queued < low)
+        InterlockedCompareExchange(&metrics->low_water, queued, low);
+    return;
+}
+
+void record_histogram(histogram* h, LONG value)
+{
+    register int i;
+    LONG max;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+        if ((ALuint)value + 1 < (2u << i))
+            break;
+    InterlockedIncrement(&h->count[i]);
+    do {
+        max = h->max;
+    } while (value > max
+          && InterlockedCompareExchange(&h->max, value, max) != max);
+    return;
+}
+
+/*
+ * Upper bound of the bucket holding the `percent`-th percentile of the
+ * samples recorded since `last`, or 0 if there were none.
+ */
+LONG histogram_percentile(const histogram* now, const histogram* last,
+    int percent)
+{
+    LONG total = 0, seen = 0;
+    register int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += now->count[i] - last->count[i];
+    if (total == 0)
+        return 0;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += now->count[i] - last->count[i];
+        if (100 * (LONGLONG)seen >= (LONGLONG)percent * total)
+            break;
+    }
+    if (i >= HISTOGRAM_BUCKETS - 1)
+        return (now->max);
+    return (LONG)((2u << i) - 2);
+}
+
+/*
+ * AL_SOFT_source_latency:  the play cursor together with the time until
+ * the device outputs what the mixer is working on now.
+ */
+LPALGETSOURCEI64VSOFT alGetSourcei64vSOFT;
+
+ALboolean load_source_latency(void)
+{
+    alGetSourcei64vSOFT = NULL;
+    if (have_cap(CAP_SOFT_SOURCE_LATENCY) == AL_FALSE)
+    {
+        printf("Failed to detect extension:  %s.\n",
+            "AL_SOFT_source_latency");
+        return AL_FALSE;
+    }
+    alGetSourcei64vSOFT = (LPALGETSOURCEI64VSOFT)
+        alGetProcAddress("alGetSourcei64vSOFT");
+    return (alGetSourcei64vSOFT != NULL);
+}
+
+/*
+ * Sample offset into the queue (whole frames) and device latency (in
+ * nanoseconds) of `src`.  Latency reads as 0 without the extension.
+ */
+void get_source_latency(ALuint src, ALint* offset, ALint64SOFT* latency)
+{
+    ALint64SOFT values[2];
+
+    if (alGetSourcei64vSOFT == NULL)
+    {
+        alGetSourcei(src, AL_SAMPLE_OFFSET, offset);
+        *latency = 0;
+        return;
+    }
+    alGetSourcei64vSOFT(src, AL_SAMPLE_OFFSET_LATENCY_SOFT, values);
+    *offset = (ALint)(values[0] >> 32); /* 32.32 fixed point */
+    *latency = values[1];
+    return;
+}
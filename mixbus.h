@@ -0,0 +1,315 @@
+/*
+ * Software mix bus:  many streams summed on the CPU into one AL source.
+ *
+ * Drivers with few hardware voices (hence ALC_STEREO_SOURCES in attrList)
+ * run out of sources long before the CPU runs out of time to mix.  The bus
+ * pulls every input a block of MIX_BLOCK frames at a time, turns it into
+ * floats, and adds it into the stereo float output with its own left and
+ * right gains.  Working block by block keeps one input's samples and the
+ * output block in L1 cache together, instead of streaming every input
+ * through memory once per AL buffer.
+ *
+ * Accumulation is in floats, so nothing clips until the stream converts the
+ * sum back to 16-bit (f32_to_s16 saturates) for alBufferData.
+ */
+#include <math.h>
+
+#define MAX_BUS_INPUTS  64
+#define MIX_BLOCK       512 /* frames summed per input per pass */
+
+typedef void (*mix_kernel)(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right);
+
+typedef struct {
+    stream_fill fill; /* at the bus rate, in `format` */
+    ALvoid* user;
+    ALenum format; /* 8-bit, 16-bit or float; mono or stereo */
+    ALsizei channels;
+    ALfloat left, right; /* gains after panning */
+    ALuint underruns; /* blocks the input came up short on */
+} bus_input;
+
+typedef struct {
+    bus_input inputs[MAX_BUS_INPUTS];
+    ALsizei count;
+    ALubyte* staging; /* one block of one input, as it comes */
+    ALfloat* scratch; /* the same, as floats */
+    mix_kernel mix_mono;
+    mix_kernel mix_stereo;
+    const char* kernels;
+    ALuint blocks;
+} mix_bus;
+
+/*
+ * scalar kernels
+ */
+void mix_mono_C(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right)
+{
+    register ALsizei i;
+
+    for (i = 0; i < frames; i++)
+    {
+        dst[2*i + 0] += src[i] * left;
+        dst[2*i + 1] += src[i] * right;
+    }
+    return;
+}
+void mix_stereo_C(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right)
+{
+    register ALsizei i;
+
+    for (i = 0; i < frames; i++)
+    {
+        dst[2*i + 0] += src[2*i + 0] * left;
+        dst[2*i + 1] += src[2*i + 1] * right;
+    }
+    return;
+}
+
+#ifdef CONVERT_SIMD
+/*
+ * SSE2 kernels, four frames per step
+ */
+void mix_mono_SSE2(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right)
+{
+    const __m128 gains = _mm_setr_ps(left, right, left, right);
+    register ALsizei i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        const __m128 v = _mm_loadu_ps(src + i);
+        __m128 a = _mm_loadu_ps(dst + 2*i + 0);
+        __m128 b = _mm_loadu_ps(dst + 2*i + 4);
+
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_unpacklo_ps(v, v), gains));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_unpackhi_ps(v, v), gains));
+        _mm_storeu_ps(dst + 2*i + 0, a);
+        _mm_storeu_ps(dst + 2*i + 4, b);
+    }
+    mix_mono_C(dst + 2*i, src + i, frames - i, left, right);
+    return;
+}
+void mix_stereo_SSE2(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right)
+{
+    const __m128 gains = _mm_setr_ps(left, right, left, right);
+    register ALsizei i;
+
+    for (i = 0; i + 4 <= frames; i += 4)
+    {
+        __m128 a = _mm_loadu_ps(dst + 2*i + 0);
+        __m128 b = _mm_loadu_ps(dst + 2*i + 4);
+
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(src + 2*i + 0), gains));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(src + 2*i + 4), gains));
+        _mm_storeu_ps(dst + 2*i + 0, a);
+        _mm_storeu_ps(dst + 2*i + 4, b);
+    }
+    mix_stereo_C(dst + 2*i, src + 2*i, frames - i, left, right);
+    return;
+}
+
+/*
+ * AVX2 kernels, eight frames per step
+ */
+TARGET_AVX2
+void mix_mono_AVX2(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right)
+{
+    const __m256 gains = _mm256_setr_ps(
+        left, right, left, right, left, right, left, right);
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        const __m128 lo = _mm_loadu_ps(src + i + 0);
+        const __m128 hi = _mm_loadu_ps(src + i + 4);
+        __m256 a = _mm256_insertf128_ps(_mm256_castps128_ps256(
+            _mm_unpacklo_ps(lo, lo)), _mm_unpackhi_ps(lo, lo), 1);
+        __m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(
+            _mm_unpacklo_ps(hi, hi)), _mm_unpackhi_ps(hi, hi), 1);
+
+        a = _mm256_add_ps(_mm256_loadu_ps(dst + 2*i + 0),
+            _mm256_mul_ps(a, gains));
+        b = _mm256_add_ps(_mm256_loadu_ps(dst + 2*i + 8),
+            _mm256_mul_ps(b, gains));
+        _mm256_storeu_ps(dst + 2*i + 0, a);
+        _mm256_storeu_ps(dst + 2*i + 8, b);
+    }
+    mix_mono_C(dst + 2*i, src + i, frames - i, left, right);
+    return;
+}
+TARGET_AVX2
+void mix_stereo_AVX2(ALfloat* dst, const ALfloat* src, ALsizei frames,
+    ALfloat left, ALfloat right)
+{
+    const __m256 gains = _mm256_setr_ps(
+        left, right, left, right, left, right, left, right);
+    register ALsizei i;
+
+    for (i = 0; i + 8 <= frames; i += 8)
+    {
+        __m256 a = _mm256_loadu_ps(dst + 2*i + 0);
+        __m256 b = _mm256_loadu_ps(dst + 2*i + 8);
+
+        a = _mm256_add_ps(a,
+            _mm256_mul_ps(_mm256_loadu_ps(src + 2*i + 0), gains));
+        b = _mm256_add_ps(b,
+            _mm256_mul_ps(_mm256_loadu_ps(src + 2*i + 8), gains));
+        _mm256_storeu_ps(dst + 2*i + 0, a);
+        _mm256_storeu_ps(dst + 2*i + 8, b);
+    }
+    mix_stereo_C(dst + 2*i, src + 2*i, frames - i, left, right);
+    return;
+}
+#endif
+
+void close_mix_bus(mix_bus* bus)
+{
+    pcm_free(bus->staging);
+    pcm_free(bus->scratch);
+    memset(bus, 0, sizeof(mix_bus));
+    return;
+}
+
+ALboolean open_mix_bus(mix_bus* bus)
+{
+#ifdef CONVERT_SIMD
+    const int features = detect_CPU_features();
+#endif
+
+    memset(bus, 0, sizeof(mix_bus));
+    bus->staging = (ALubyte *)pcm_alloc(MIX_BLOCK * 2 * sizeof(ALfloat));
+    bus->scratch = (ALfloat *)pcm_alloc(MIX_BLOCK * 2 * sizeof(ALfloat));
+    if (bus->staging == NULL || bus->scratch == NULL)
+    {
+        printf("Failed to allocate mix bus memory.\n");
+        close_mix_bus(bus);
+        return AL_FALSE;
+    }
+    bus->mix_mono = mix_mono_C;
+    bus->mix_stereo = mix_stereo_C;
+    bus->kernels = "scalar";
+#ifdef CONVERT_SIMD
+    if (features & CPU_AVX2)
+    {
+        bus->mix_mono = mix_mono_AVX2;
+        bus->mix_stereo = mix_stereo_AVX2;
+        bus->kernels = "AVX2";
+    }
+    else if (features & CPU_SSE2)
+    {
+        bus->mix_mono = mix_mono_SSE2;
+        bus->mix_stereo = mix_stereo_SSE2;
+        bus->kernels = "SSE2";
+    }
+#endif
+    return AL_TRUE;
+}
+
+/*
+ * `pan` runs from -1 (left) to +1 (right).  Mono inputs pan at constant
+ * power; stereo inputs get a balance control, full volume at the center.
+ */
+void set_bus_input(mix_bus* bus, ALsizei input, ALfloat gain, ALfloat pan)
+{
+    bus_input* in = &bus->inputs[input];
+
+    if (pan < -1.0F)
+        pan = -1.0F;
+    if (pan > +1.0F)
+        pan = +1.0F;
+    if (in->channels == 1)
+    {
+        const ALdouble angle = (pan + 1.0) * (3.14159265358979 / 4);
+
+        in->left = (ALfloat)(gain * cos(angle));
+        in->right = (ALfloat)(gain * sin(angle));
+    }
+    else
+    {
+        in->left = gain * ((pan > 0) ? 1.0F - pan : 1.0F);
+        in->right = gain * ((pan < 0) ? 1.0F + pan : 1.0F);
+    }
+    return;
+}
+
+/*
+ * Returns the new input's index, or -1 if the bus is full or cannot mix
+ * `format`.  Every input must already run at the bus's sample rate.
+ */
+ALsizei add_bus_input(mix_bus* bus, stream_fill fill, ALvoid* user,
+    ALenum format, ALfloat gain, ALfloat pan)
+{
+    bus_input* in;
+
+    if (bus->count >= MAX_BUS_INPUTS || format_channels(format) == 0)
+    {
+        printf("The mix bus cannot take another input of 0x%04X.\n", format);
+        return -1;
+    }
+    in = &bus->inputs[bus->count];
+    in->fill = fill;
+    in->user = user;
+    in->format = format;
+    in->channels = format_channels(format);
+    in->underruns = 0;
+    set_bus_input(bus, bus->count, gain, pan);
+    return (bus->count++);
+}
+
+/*
+ * stream_fill producing AL_FORMAT_STEREO_FLOAT32:  the sum of every input.
+ */
+ALsizei fill_mix_bus(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    mix_bus* bus = (mix_bus *)user;
+    ALfloat* out = (ALfloat *)data;
+    register ALsizei done, i;
+
+    for (done = 0; done < frames; done += MIX_BLOCK)
+    {
+        const ALsizei count = (frames - done < MIX_BLOCK)
+            ? frames - done : MIX_BLOCK;
+        ALfloat* dst = out + 2*done;
+
+        memset(dst, 0, count * 2 * sizeof(ALfloat));
+        for (i = 0; i < bus->count; i++)
+        {
+            bus_input* in = &bus->inputs[i];
+            const ALboolean is_float = (in->format == float_format(in->format));
+            ALvoid* raw = is_float ? (ALvoid *)bus->scratch : bus->staging;
+            ALsizei got;
+
+            got = in->fill(in->user, raw, count);
+            if (got < 0)
+                got = 0;
+            if (got < count)
+                ++in->underruns;
+            if (!is_float)
+                convert_samples(bus->scratch, float_format(in->format),
+                    bus->staging, in->format, 0, got);
+            if (in->channels == 1)
+                bus->mix_mono(dst, bus->scratch, got, in->left, in->right);
+            else
+                bus->mix_stereo(dst, bus->scratch, got, in->left, in->right);
+        }
+        ++bus->blocks;
+    }
+    return (frames);
+}
+
+void log_mix_bus(const mix_bus* bus)
+{
+    ALuint underruns = 0;
+    register ALsizei i;
+
+    for (i = 0; i < bus->count; i++)
+        underruns += bus->inputs[i].underruns;
+    printf("Mix bus (%s):  %i inputs, %u blocks, %u short input blocks\n",
+        bus->kernels, bus->count, bus->blocks, underruns);
+    return;
+}
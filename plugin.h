@@ -0,0 +1,252 @@
+/*
+ * Audio plugin interface, for an emulator to play through instead of
+ * test.wav:  the N64's AI (audio interface) hands each DMA buffer over to
+ * audio_push() as it would to the DAC.
+ *
+ * audio_open() sets up the device, context, listener and source the same
+ * way main() does, then streams from a sample ring through a dedicated
+ * audio thread (ring.h), so audio_push() only ever copies into the ring.
+ * AI samples are 16-bit stereo in the N64's byte order; `flags` (SAMPLE_*
+ * in convert.h) says what the emulator's view of RDRAM left to undo, big-
+ * endian bytes or left and right swapped within 32-bit words, and the
+ * stream undoes it as it uploads.
+ *
+ * With sync on, audio_push() blocks until the device has played enough
+ * that no more than `ms` milliseconds stay in the ring.  The ring is only
+ * drained as AL finishes buffers, so the emulator then runs off the sound
+ * card's clock:  no frame limiter of its own, and no drift between two
+ * clocks to pile up into overruns or underruns.
+ *
+ * Built with AUDIO_PLUGIN defined, the audio_*() functions are exported.
+ */
+#ifdef AUDIO_PLUGIN
+#define AUDIO_API       __declspec(dllexport)
+#else
+#define AUDIO_API
+#endif
+
+#define PLUGIN_DEPTH    4 /* buffers queued to AL */
+#define PLUGIN_FRAMES   (BUFFER_SIZE / 4) /* frames each, 25 ms at 44.1 kHz */
+#define PLUGIN_RING     65536 /* frames, over a second at 48 kHz */
+
+typedef struct {
+    ALboolean open;
+    ALsizei frequency;
+    ALuint flags; /* SAMPLE_* */
+    sample_ring ring;
+    AL_stream stream;
+    stream_events events;
+    audio_thread audio;
+    HANDLE drained; /* auto-reset, set when the audio thread reads the ring */
+
+    volatile ALboolean sync;
+    ALsizei sync_frames; /* most frames left in the ring by a synced push */
+    ALuint pushes;
+    ALuint waits; /* pushes held back by the sync throttle */
+} audio_plugin;
+
+audio_plugin plugin;
+
+/*
+ * stream_fill for the audio thread:  whatever the emulator has pushed.
+ */
+ALsizei fill_plugin(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    audio_plugin* p = (audio_plugin *)user;
+    const ALsizei got = ring_read(&p->ring, data, frames);
+
+    SetEvent(p->drained);
+    return (got);
+}
+
+/*
+ * Open the stream at `frequency`, primed with a buffer of silence, and set
+ * the audio thread going.
+ */
+ALboolean start_plugin_stream(audio_plugin* p, ALsizei frequency)
+{
+    static const ALshort silence[2 * 1024];
+
+    p->frequency = frequency;
+    if (open_stream(&p->stream, source, AL_FORMAT_STEREO16, frequency,
+            PLUGIN_DEPTH, PLUGIN_FRAMES, fill_plugin, p) == AL_FALSE)
+        return AL_FALSE;
+    if (convert_stream(&p->stream, AL_FORMAT_STEREO16, p->flags) == AL_FALSE
+     || open_stream_events(&p->events, source,
+            1000 * PLUGIN_FRAMES / frequency, 5) == AL_FALSE)
+    {
+        close_stream(&p->stream);
+        return AL_FALSE;
+    }
+    while (ring_fill_level(&p->ring) < PLUGIN_FRAMES)
+        ring_write(&p->ring, silence, 1024); /* room to start playing in */
+    update_stream(&p->stream);
+    p->stream.playing = AL_TRUE;
+    alSourcePlay(source);
+    if (start_audio_thread(&p->audio, &p->stream, &p->events, NULL))
+        return AL_TRUE;
+    p->stream.playing = AL_FALSE;
+    close_stream_events(&p->events);
+    close_stream(&p->stream);
+    return AL_FALSE;
+}
+
+void stop_plugin_stream(audio_plugin* p)
+{
+    stop_audio_thread(&p->audio);
+    close_stream_events(&p->events);
+    close_stream(&p->stream);
+    return;
+}
+
+AUDIO_API void audio_close(void)
+{
+    if (plugin.open == AL_FALSE)
+        return;
+    stop_plugin_stream(&plugin);
+    close_ring(&plugin.ring);
+    CloseHandle(plugin.drained);
+    finish_AL_context();
+    plugin.open = AL_FALSE;
+    return;
+}
+
+/*
+ * Bring up the default device to play AI samples at `frequency`.
+ */
+AUDIO_API ALboolean audio_open(ALsizei frequency, ALuint flags)
+{
+    ALCdevice* device;
+    ALCcontext* context;
+
+    if (plugin.open)
+        audio_close();
+    memset(&plugin, 0, sizeof(audio_plugin));
+    plugin.flags = flags;
+    device = init_AL_device();
+    if (device == NULL)
+        return AL_FALSE;
+    context = alcCreateContext(device, NULL);
+    if (context == NULL || alcMakeContextCurrent(context) == ALC_FALSE)
+    {
+        printf("Failed to initialize AL.\n");
+        if (context != NULL)
+            alcDestroyContext(context);
+        alcCloseDevice(device);
+        return AL_FALSE;
+    }
+    init_converter();
+    load_deferred_updates();
+    load_source_latency();
+    if ((initialize_listener() & initialize_source()) == AL_FALSE
+     || open_ring(&plugin.ring, PLUGIN_RING, 4) == AL_FALSE)
+    {
+        finish_AL_context();
+        return AL_FALSE;
+    }
+    plugin.drained = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (plugin.drained == NULL || !start_plugin_stream(&plugin, frequency))
+    {
+        printf("Unable to start the plugin stream.\n");
+        if (plugin.drained != NULL)
+            CloseHandle(plugin.drained);
+        close_ring(&plugin.ring);
+        finish_AL_context();
+        return AL_FALSE;
+    }
+    plugin.open = AL_TRUE;
+    return AL_TRUE;
+}
+
+/*
+ * The AI's DAC rate changed.  What is still in the ring plays at the new
+ * rate, which at worst is one short blip.
+ */
+AUDIO_API ALboolean audio_set_frequency(ALsizei frequency)
+{
+    const ALsizei old_frequency = plugin.frequency;
+
+    if (plugin.open == AL_FALSE || frequency <= 0)
+        return AL_FALSE;
+    if (frequency == plugin.frequency)
+        return AL_TRUE;
+    stop_plugin_stream(&plugin);
+    if (start_plugin_stream(&plugin, frequency) == AL_FALSE)
+    {
+        printf("Unable to restart the plugin stream at %i Hz.\n", frequency);
+        close_ring(&plugin.ring);
+        CloseHandle(plugin.drained);
+        finish_AL_context();
+        plugin.open = AL_FALSE;
+        return AL_FALSE;
+    }
+    plugin.sync_frames = (ALsizei)((ALdouble)plugin.sync_frames
+        * frequency / old_frequency);
+    return AL_TRUE;
+}
+
+/*
+ * Block synced pushes once `ms` milliseconds are waiting in the ring;
+ * `ms` of 0 turns the throttle off.
+ */
+AUDIO_API void audio_sync(ALuint ms)
+{
+    plugin.sync_frames = (ALsizei)(ms * plugin.frequency / 1000);
+    plugin.sync = (ms != 0);
+    return;
+}
+
+/*
+ * One AI DMA:  `bytes` of 16-bit stereo.  Returns the count of frames
+ * taken, short of the whole lot only if the ring overflowed while unsynced.
+ */
+AUDIO_API ALsizei audio_push(const ALvoid* data, ALsizei bytes)
+{
+    const ALsizei frames = bytes / 4;
+    const DWORD timeout = 1000 * PLUGIN_FRAMES / plugin.frequency + 1;
+
+    if (plugin.open == AL_FALSE || frames <= 0)
+        return 0;
+    ++plugin.pushes;
+    if (plugin.sync)
+    {
+        ALsizei level = ring_fill_level(&plugin.ring);
+
+        if (level > 0 && level + frames > plugin.sync_frames)
+            ++plugin.waits;
+        while (level > 0 && level + frames > plugin.sync_frames)
+        { /* The time-out only guards against a stalled audio thread. */
+            if (WaitForSingleObject(plugin.drained, timeout) != WAIT_OBJECT_0)
+                break;
+            level = ring_fill_level(&plugin.ring);
+        }
+    }
+    return ring_write(&plugin.ring, data, frames);
+}
+
+/*
+ * Milliseconds from a push until it is heard:  the ring, the unplayed part
+ * of AL's queue and the device's own latency (AL_SOFT_source_latency).
+ */
+AUDIO_API ALuint audio_latency_ms(void)
+{
+    ALint offset;
+    ALint64SOFT latency;
+    ALsizei frames;
+
+    if (plugin.open == AL_FALSE)
+        return 0;
+    get_source_latency(source, &offset, &latency);
+    frames = ring_fill_level(&plugin.ring)
+        + stream_latency_frames(&plugin.stream);
+    return (ALuint)(1000.0 * frames / plugin.frequency + latency / 1000000);
+}
+
+void log_audio_plugin(void)
+{
+    printf("Plugin:  %u pushes, %u held back by sync, %u underruns, "
+        "%u ms latency\n", plugin.pushes, plugin.waits,
+        plugin.stream.underruns, audio_latency_ms());
+    log_ring_counters(&plugin.ring);
+    return;
+}
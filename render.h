@@ -0,0 +1,357 @@
+/*
+ * Scripted offline rendering to a WAVE file, for regression tests.
+ *
+ * A script is a text file of cues, one per line, in order of time:
+ *
+ *     # frame  key  [value]
+ *     0        P
+ *     22050    F    1.5
+ *     44100    V    0.25
+ *     66150    H
+ *     88200    Q
+ *
+ * Each cue does at exactly that output sample frame what the same key does
+ * in the interactive tester:  P, H, S and R play, pause, stop and rewind,
+ * F sets the pitch and V the volume; Q ends the render, which otherwise
+ * runs one second past the last cue.  Lines starting with # are ignored.
+ *
+ * The session plays test.wav on an ALC_SOFT_loopback device, so it renders
+ * as fast as the mixer can go, and identically on any machine running the
+ * same OpenAL build.  -s streams it through the buffer queue instead of one
+ * looping buffer, -r through the resampler as well, and -f32 uploads floats,
+ * so each of those paths can be checked.
+ *
+ * The result goes to a 16-bit stereo WAVE file along with an FNV-1a hash of
+ * its samples, to compare against a known good hash.  Given a golden WAVE
+ * file too, every sample gets compared against it, failing the render if
+ * any one is off by more than the tolerance.
+ */
+#define RENDER_RATE     44100
+#define RENDER_CHUNK    1024 /* most frames per alcRenderSamplesSOFT call */
+#define MAX_CUES        1024
+
+typedef struct {
+    ALsizei frame;
+    int key; /* P, H, S, R, F, V or Q */
+    ALfloat value;
+} render_cue;
+
+typedef struct {
+    const char* script;
+    const char* output;
+    const char* golden; /* or NULL */
+    ALint tolerance; /* largest sample difference from `golden` to pass */
+    ALboolean streamed;
+    ALboolean resampled;
+    int quality; /* RESAMPLE_* */
+    ALboolean as_float;
+
+    render_cue cues[MAX_CUES];
+    ALsizei cue_count;
+    ALsizei length; /* in sample frames */
+
+    ALdouble seconds; /* spent rendering */
+    ALuint hash;
+    ALint max_difference;
+    ALsizei differences; /* samples off from `golden` at all */
+} render_job;
+
+ALboolean load_render_script(render_job* job)
+{
+    char line[256];
+    FILE* script;
+    int line_number = 0;
+
+    job->cue_count = 0;
+    job->length = -1;
+    script = fopen(job->script, "r");
+    if (script == NULL)
+    {
+        printf("Unable to read render script \"%s\".\n", job->script);
+        return AL_FALSE;
+    }
+    while (fgets(line, sizeof(line), script) != NULL)
+    {
+        render_cue* cue = &job->cues[job->cue_count];
+        char key;
+        int fields;
+
+        ++line_number;
+        if (line[strspn(line, " \t")] == '#')
+            continue;
+        cue->value = 1.0F;
+        fields = sscanf(line, " %d %c %f", &cue->frame, &key, &cue->value);
+        if (fields <= 0)
+            continue;
+        cue->key = key & ~0x20; /* lowercase-to-uppercase conversion */
+        if (fields < 2 || cue->frame < 0 || strchr("PHSRFVQ", cue->key) == NULL
+         || ((cue->key == 'F' || cue->key == 'V') && fields < 3)
+         || (job->cue_count > 0 && cue->frame < cue[-1].frame))
+        {
+            printf("%s(%i):  bad or out-of-order cue\n", job->script,
+                line_number);
+            fclose(script);
+            return AL_FALSE;
+        }
+        if (cue->key == 'Q')
+        {
+            job->length = cue->frame;
+            break;
+        }
+        if (++job->cue_count == MAX_CUES)
+            break;
+    }
+    fclose(script);
+    if (job->length < 0)
+        job->length = (job->cue_count > 0)
+            ? job->cues[job->cue_count - 1].frame + RENDER_RATE : RENDER_RATE;
+    return AL_TRUE;
+}
+
+/*
+ * canonical 44-byte header of 16-bit stereo PCM
+ */
+void write_render_header(FILE* out, ALsizei frames)
+{
+    ALubyte header[44];
+    const ALuint data_size = (ALuint)frames * 4;
+    const ALuint fields[] = {
+        0x46464952, 36 + data_size, 0x45564157, /* "RIFF" size "WAVE" */
+        0x20746D66, 16, 0x00020001, RENDER_RATE, RENDER_RATE * 4,
+        0x00100004, /* "fmt " ... bits per sample and block align */
+        0x61746164, data_size /* "data" size */
+    };
+    register int i;
+
+    for (i = 0; i < 11; i++)
+    {
+        header[4*i + 0] = (ALubyte)(fields[i] >>  0);
+        header[4*i + 1] = (ALubyte)(fields[i] >>  8);
+        header[4*i + 2] = (ALubyte)(fields[i] >> 16);
+        header[4*i + 3] = (ALubyte)(fields[i] >> 24);
+    }
+    fseek(out, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, out);
+    return;
+}
+
+/*
+ * What the interactive tester's key does.  `r` is NULL unless resampling
+ * the input from `rate`.
+ */
+void apply_cue(const render_cue* cue, AL_stream* stream, resampler* r,
+    ALsizei rate)
+{
+    switch (cue->key)
+    {
+    case 'P':
+        alSourcePlay(source);
+        stream->playing = AL_TRUE;
+        break;
+    case 'H':
+        stream->playing = AL_FALSE;
+        alSourcePause(source);
+        break;
+    case 'S':
+        stream->playing = AL_FALSE;
+        alSourceStop(source);
+        break;
+    case 'R':
+        stream->playing = AL_FALSE;
+        alSourceRewind(source);
+        break;
+    case 'F':
+        if (r != NULL)
+            request_resample_rate(r, rate * cue->value);
+        else
+        {
+            batch_sourcef(&updates, &source_state, AL_PITCH, cue->value);
+            commit_updates(&updates);
+        }
+        break;
+    case 'V':
+        change_volume(cue->value);
+        break;
+    }
+    return;
+}
+
+/*
+ * Hash, write and check against the golden samples one rendered block.
+ */
+void take_render_block(render_job* job, FILE* out, const ALshort* block,
+    ALsizei frames, const wave_file* golden, ALsizei done)
+{
+    register ALsizei i;
+
+    fwrite(block, 4, frames, out);
+    job->hash = FNV_1a((const ALubyte *)block, 4 * frames, job->hash);
+    if (golden == NULL)
+        return;
+    for (i = 0; i < 2 * frames; i++)
+    {
+        const ALsizei at = 2 * done + i; /* in samples */
+        ALint difference = (2 * at + 2 <= golden->size)
+            ? (ALshort)read_LE16(golden->data + 2 * at) - block[i] : 65536;
+
+        if (difference < 0)
+            difference = -difference;
+        if (difference > job->max_difference)
+            job->max_difference = difference;
+        if (difference != 0)
+            ++job->differences;
+    }
+    return;
+}
+
+/*
+ * Render the script with test.wav into `out`, its header written last.
+ * Returns AL_FALSE if the loopback session could not be set up.
+ */
+ALboolean render_session(render_job* job, const wave_file* wave,
+    const wave_file* golden, FILE* out)
+{
+    ALCdevice* device;
+    ALCcontext* context;
+    ALshort block[2 * RENDER_CHUNK];
+    memory_loop loop;
+    AL_stream stream;
+    resampler r;
+    ALdouble start;
+    ALsizei done, frames, cue;
+    ALboolean success;
+
+    write_render_header(out, 0);
+    context = open_loopback_context(&device, RENDER_RATE, 4);
+    if (context == NULL)
+        return AL_FALSE;
+    load_deferred_updates();
+    success = initialize_listener() & initialize_source();
+    init_update_batch(&updates);
+    init_source_shadow(&source_state, source);
+
+    memset(&stream, 0, sizeof(AL_stream));
+    memset(&r, 0, sizeof(resampler));
+    loop.data = wave->data;
+    loop.size = wave->size;
+    loop.cursor = 0;
+    loop.frame_size = format_frame_size(wave->format);
+    alGenBuffers(NUM_BUFFERS, &buffer);
+    if (job->streamed && job->resampled)
+    {
+        success &= open_resampler(&r, job->quality, wave->format,
+            wave->frequency, RENDER_RATE, fill_memory_loop, &loop);
+        success &= open_stream(&stream, source, float_format(wave->format),
+            RENDER_RATE, 4, BUFFER_SIZE, fill_resampled, &r);
+        success &= convert_stream(&stream, job->as_float
+            ? float_format(wave->format) : int16_format(wave->format), 0);
+    }
+    else if (job->streamed)
+    {
+        success &= open_stream(&stream, source, wave->format,
+            wave->frequency, 4, BUFFER_SIZE, fill_memory_loop, &loop);
+        if (job->as_float)
+            success &= convert_stream(&stream, float_format(wave->format), 0);
+    }
+    else
+    {
+        success &= upload_wave(buffer, wave, job->as_float);
+        alSourcei(source, AL_BUFFER, buffer);
+        alSourcei(source, AL_LOOPING, AL_TRUE);
+    }
+
+    if (success)
+    {
+        if (job->streamed)
+            update_stream(&stream); /* Prime the queue. */
+        job->hash = FNV_BASIS;
+        job->max_difference = 0;
+        job->differences = 0;
+        cue = 0;
+        start = seconds_now();
+        for (done = 0; done < job->length; done += frames)
+        {
+            frames = job->length - done;
+            while (cue < job->cue_count && job->cues[cue].frame <= done)
+                apply_cue(&job->cues[cue++], &stream,
+                    (job->streamed && job->resampled) ? &r : NULL,
+                    wave->frequency);
+            if (cue < job->cue_count && job->cues[cue].frame - done < frames)
+                frames = job->cues[cue].frame - done; /* sample-accurate */
+            if (frames > RENDER_CHUNK)
+                frames = RENDER_CHUNK;
+            alcRenderSamplesSOFT(device, block, frames);
+            if (job->streamed)
+                update_stream(&stream);
+            take_render_block(job, out, block, frames, golden, done);
+        }
+        job->seconds = seconds_now() - start;
+        write_render_header(out, job->length);
+    }
+    else
+        printf("Unable to set up the render.\n");
+
+    if (stream.depth != 0)
+        close_stream(&stream);
+    close_resampler(&r); /* harmless if never opened */
+    alDeleteSources(NUM_SOURCES, &source);
+    alDeleteBuffers(NUM_BUFFERS, &buffer);
+    close_loopback_context(device, context);
+    return (success);
+}
+
+/*
+ * Returns 0 if the render completed and matched any golden file.
+ */
+int run_render(render_job* job)
+{
+    wave_file wave, golden;
+    FILE* out;
+    int failed = 1;
+
+    if (load_render_script(job) == AL_FALSE || !load_loopback_functions())
+        return 1;
+    if (open_wave(&wave, "test.wav") == AL_FALSE)
+        return 1;
+    if (job->golden != NULL && open_wave(&golden, job->golden) == AL_FALSE)
+    {
+        close_wave(&wave);
+        return 1;
+    }
+
+    if (job->golden != NULL && (golden.format != AL_FORMAT_STEREO16
+     || golden.frequency != RENDER_RATE))
+        printf("\"%s\" is not 16-bit stereo at %i Hz.\n", job->golden,
+            RENDER_RATE);
+    else if (job->streamed && wave.format != wave.pcm_format)
+        printf("Only PCM test.wav files can be streamed in a render.\n");
+    else if ((out = fopen(job->output, "wb")) == NULL)
+        printf("Unable to write \"%s\".\n", job->output);
+    else
+    {
+        if (render_session(job, &wave,
+                (job->golden != NULL) ? &golden : NULL, out))
+            failed = 0;
+        fclose(out);
+    }
+    close_wave(&wave);
+    if (job->golden != NULL)
+    {
+        if (golden.frames != job->length)
+            job->max_difference = 65536; /* lengths differ */
+        close_wave(&golden);
+    }
+    if (failed)
+        return 1;
+
+    printf("Rendered %i frames to \"%s\" in %.3f s (%.1fx realtime).\n",
+        job->length, job->output, job->seconds,
+        job->length / (job->seconds * RENDER_RATE));
+    printf("Hash:  %08X\n", job->hash);
+    if (job->golden == NULL)
+        return 0;
+    printf("Against \"%s\":  %i samples differ, by at most %i (%s)\n",
+        job->golden, job->differences, job->max_difference,
+        (job->max_difference <= job->tolerance) ? "pass" : "FAIL");
+    return (job->max_difference <= job->tolerance) ? 0 : 1;
+}
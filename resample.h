@@ -0,0 +1,469 @@
+/*
+ * Sample-rate conversion of incoming streams to the device mixing rate.
+ *
+ * N64 games play at odd rates like 32006 or 22047 Hz which drift as the
+ * emulator throttles, while the device mixes at ALC_FREQUENCY.  Rather than
+ * nudging AL_PITCH, the resampler sits between the producer and the stream
+ * and reads its input at a fractional, adjustable step per output frame.
+ *
+ * Three qualities are offered:  linear and 4-point cubic interpolation, and
+ * a 32-tap Kaiser-windowed sinc filter.  The sinc taps for 256 sub-sample
+ * phases are precomputed; each output sample blends two adjacent phases,
+ * with the dot products done four or eight taps at a time.  A rate change
+ * needing a new cutoff gets its table built by the thread asking for it,
+ * in a spare, which the audio thread then swaps in with a pointer exchange:
+ * nothing on the audio thread allocates or evaluates a sinc.
+ *
+ * The read position is a 12.20 fixed-point accumulator that carries across
+ * calls, so changing the rate never jumps the phase.  New rates are also
+ * ramped in over RESAMPLE_RAMP output frames rather than switched at once.
+ */
+#include <math.h>
+
+#define RESAMPLE_LINEAR     0
+#define RESAMPLE_CUBIC      1
+#define RESAMPLE_SINC       2
+
+#define FRAC_BITS       20
+#define FRAC_ONE        (1 << FRAC_BITS)
+#define FRAC_MASK       (FRAC_ONE - 1)
+#define PHASE_BITS      8
+#define PHASES          (1 << PHASE_BITS)
+#define SINC_TAPS       32
+#define KAISER_BETA     8.0
+
+#define RESAMPLE_CHUNK  1024 /* input frames pulled from upstream at a time */
+#define RESAMPLE_RAMP   512 /* output frames to glide over to a new rate */
+
+typedef struct {
+    ALfloat coeffs[PHASES * SINC_TAPS];
+    ALfloat deltas[PHASES * SINC_TAPS]; /* next phase minus this one */
+} sinc_table;
+
+typedef ALfloat (*dot_product)(
+    const ALfloat* x, const ALfloat* coeffs, const ALfloat* deltas, ALfloat t);
+
+typedef struct {
+    int quality;
+    stream_fill fill; /* upstream producer, at the input rate */
+    ALvoid* user;
+    ALenum in_format;
+    ALsizei channels;
+    ALubyte* in_staging; /* upstream frames as they come */
+    ALfloat* in_float; /* the same, as interleaved floats */
+
+    ALfloat* history[2]; /* planar input frames around the read position */
+    ALsizei avail; /* frames held in `history` */
+    ALsizei pos; /* integer part of the read position into `history` */
+    ALuint frac; /* fractional part of the read position */
+
+    ALuint step; /* input frames per output frame, 12.20 fixed point */
+    ALuint target_step;
+    ALint step_delta;
+    ALsizei ramp; /* output frames left until `step` reaches the target */
+    ALdouble in_rate;
+    ALdouble out_rate;
+
+    sinc_table* table; /* in use by fill_resampled() */
+    sinc_table* volatile pending; /* built for a new rate, not taken up yet */
+    sinc_table* volatile spare; /* free to build the next one in */
+    ALdouble cutoff; /* of the latest table built, relative to input Nyquist */
+    dot_product dot;
+    volatile LONG requested; /* new input rate in mHz from another thread */
+} resampler;
+
+#define HISTORY_SIZE    (RESAMPLE_CHUNK + 2*SINC_TAPS)
+#define HALF_TAPS       (SINC_TAPS / 2)
+
+ALfloat dot_C(
+    const ALfloat* x, const ALfloat* coeffs, const ALfloat* deltas, ALfloat t)
+{
+    ALfloat sum = 0, slope = 0;
+    register int i;
+
+    for (i = 0; i < SINC_TAPS; i++)
+    {
+        sum += coeffs[i] * x[i];
+        slope += deltas[i] * x[i];
+    }
+    return (sum + t*slope);
+}
+
+#ifdef CONVERT_SIMD
+ALfloat dot_SSE2(
+    const ALfloat* x, const ALfloat* coeffs, const ALfloat* deltas, ALfloat t)
+{
+    __m128 sum = _mm_setzero_ps();
+    __m128 slope = _mm_setzero_ps();
+    ALfloat lanes[4];
+    register int i;
+
+    for (i = 0; i < SINC_TAPS; i += 4)
+    {
+        const __m128 v = _mm_loadu_ps(x + i);
+
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(coeffs + i), v));
+        slope = _mm_add_ps(slope, _mm_mul_ps(_mm_loadu_ps(deltas + i), v));
+    }
+    sum = _mm_add_ps(sum, _mm_mul_ps(slope, _mm_set1_ps(t)));
+    _mm_storeu_ps(lanes, sum);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+TARGET_AVX2
+ALfloat dot_AVX2(
+    const ALfloat* x, const ALfloat* coeffs, const ALfloat* deltas, ALfloat t)
+{
+    __m256 sum = _mm256_setzero_ps();
+    __m256 slope = _mm256_setzero_ps();
+    __m128 half;
+    ALfloat lanes[4];
+    register int i;
+
+    for (i = 0; i < SINC_TAPS; i += 8)
+    {
+        const __m256 v = _mm256_loadu_ps(x + i);
+
+        sum = _mm256_add_ps(sum,
+            _mm256_mul_ps(_mm256_loadu_ps(coeffs + i), v));
+        slope = _mm256_add_ps(slope,
+            _mm256_mul_ps(_mm256_loadu_ps(deltas + i), v));
+    }
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(slope, _mm256_set1_ps(t)));
+    half = _mm_add_ps(
+        _mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    _mm_storeu_ps(lanes, half);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+#endif
+
+/*
+ * zeroth-order modified Bessel function of the first kind, for the window
+ */
+ALdouble bessel_I0(ALdouble x)
+{
+    ALdouble term = 1, sum = 1;
+    register int k;
+
+    for (k = 1; k < 32; k++)
+    {
+        term *= (x / (2*k)) * (x / (2*k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return (sum);
+}
+
+/*
+ * the windowed sinc at phase `p` of PHASES, low-passed at `cutoff` times
+ * the input Nyquist rate and normalized to unity gain at DC
+ */
+void sinc_phase(ALfloat* phase, int p, ALdouble cutoff)
+{
+    ALdouble sum = 0;
+    register int k;
+
+    for (k = 0; k < SINC_TAPS; k++)
+    {
+        const ALdouble x = (k - (HALF_TAPS - 1)) - (ALdouble)p / PHASES;
+        const ALdouble w = x / HALF_TAPS;
+        ALdouble s = cutoff;
+
+        if (x != 0)
+            s = sin(3.14159265358979323846 * cutoff * x)
+              / (3.14159265358979323846 * x);
+        if (w > -1 && w < 1)
+            s *= bessel_I0(KAISER_BETA * sqrt(1 - w*w))
+               / bessel_I0(KAISER_BETA);
+        else
+            s = 0;
+        phase[k] = (ALfloat)s;
+        sum += s;
+    }
+    for (k = 0; k < SINC_TAPS; k++)
+        phase[k] = (ALfloat)(phase[k] / sum);
+    return;
+}
+
+void build_sinc_table(sinc_table* table, ALdouble cutoff)
+{
+    ALfloat last[SINC_TAPS]; /* phase PHASES, i.e. 0 of the next tap over */
+    register int p, k;
+
+    for (p = 0; p < PHASES; p++)
+        sinc_phase(table->coeffs + p*SINC_TAPS, p, cutoff);
+    sinc_phase(last, PHASES, cutoff);
+    for (p = 0; p < PHASES; p++)
+    {
+        const ALfloat* next = (p + 1 < PHASES)
+            ? table->coeffs + (p + 1)*SINC_TAPS : last;
+
+        for (k = 0; k < SINC_TAPS; k++)
+            table->deltas[p*SINC_TAPS + k] =
+                next[k] - table->coeffs[p*SINC_TAPS + k];
+    }
+    return;
+}
+
+/*
+ * Below the input rate, the filter must also cut what would otherwise alias
+ * back down from above the output Nyquist rate.  A little headroom under
+ * 1.0 keeps the transition band out of the audible top octave's way.
+ */
+ALdouble resample_cutoff(ALdouble in_rate, ALdouble out_rate)
+{
+    const ALdouble ratio = out_rate / in_rate;
+
+    return 0.92 * ((ratio < 1) ? ratio : 1);
+}
+
+ALuint resample_step(ALdouble in_rate, ALdouble out_rate)
+{
+    return (ALuint)(in_rate / out_rate * FRAC_ONE + 0.5);
+}
+
+void close_resampler(resampler* r)
+{
+    pcm_free(r->in_staging);
+    pcm_free(r->in_float);
+    free(r->history[0]);
+    free(r->history[1]);
+    free(r->table);
+    free(r->pending);
+    free(r->spare);
+    memset(r, 0, sizeof(resampler));
+    return;
+}
+
+ALboolean open_resampler(
+    resampler* r, int quality, ALenum in_format, ALdouble in_rate,
+    ALdouble out_rate, stream_fill fill, ALvoid* user)
+{
+    register ALsizei c;
+
+    memset(r, 0, sizeof(resampler));
+    r->quality = quality;
+    r->fill = fill;
+    r->user = user;
+    r->in_format = in_format;
+    r->channels = format_channels(in_format);
+    r->in_rate = in_rate;
+    r->out_rate = out_rate;
+    if (r->channels == 0 || !(in_rate > 0 && in_rate < 4095 * out_rate))
+    {
+        printf("Cannot resample %g Hz to %g Hz.\n", in_rate, out_rate);
+        return AL_FALSE;
+    }
+    r->step = r->target_step = resample_step(in_rate, out_rate);
+
+    r->in_staging = (ALubyte *)pcm_alloc(
+        RESAMPLE_CHUNK * format_frame_size(in_format));
+    r->in_float = (ALfloat *)pcm_alloc(
+        RESAMPLE_CHUNK * r->channels * sizeof(ALfloat));
+    for (c = 0; c < r->channels; c++)
+        r->history[c] = (ALfloat *)calloc(HISTORY_SIZE, sizeof(ALfloat));
+    if (quality == RESAMPLE_SINC)
+    {
+        r->table = (sinc_table *)malloc(sizeof(sinc_table));
+        r->spare = (sinc_table *)malloc(sizeof(sinc_table));
+    }
+    if (r->in_staging == NULL || r->in_float == NULL
+     || r->history[0] == NULL || r->history[r->channels - 1] == NULL
+     || (quality == RESAMPLE_SINC && (r->table == NULL || r->spare == NULL)))
+    {
+        printf("Failed to allocate resampler memory.\n");
+        close_resampler(r);
+        return AL_FALSE;
+    }
+    if (quality == RESAMPLE_SINC)
+    {
+        r->cutoff = resample_cutoff(in_rate, out_rate);
+        build_sinc_table(r->table, r->cutoff);
+    }
+
+    r->dot = dot_C;
+#ifdef CONVERT_SIMD
+    c = detect_CPU_features();
+    if (c & CPU_AVX2)
+        r->dot = dot_AVX2;
+    else if (c & CPU_SSE2)
+        r->dot = dot_SSE2;
+#endif
+
+/*
+ * Start with half a filter of silence behind the read position, so the
+ * first output frame lines up with the first input frame.
+ */
+    r->pos = HALF_TAPS - 1;
+    r->avail = HALF_TAPS - 1;
+    return AL_TRUE;
+}
+
+/*
+ * Change the input rate, as when the emulated DAC rate changes or drifts.
+ * Only the rate of advance glides over; the read position stays put.
+ * The filter cutoff is left to request_resample_rate().
+ */
+void set_resample_rate(resampler* r, ALdouble in_rate)
+{
+    ALuint target;
+
+    if (!(in_rate > 0 && in_rate < 4095 * r->out_rate))
+        return; /* out of the 12.20 fixed-point step's range */
+    target = resample_step(in_rate, r->out_rate);
+    r->in_rate = in_rate;
+    r->target_step = target;
+    r->step_delta = ((ALint)target - (ALint)r->step) / RESAMPLE_RAMP;
+    r->ramp = RESAMPLE_RAMP;
+    return;
+}
+
+/*
+ * The same, from a thread other than the one pulling output (and only ever
+ * the one); it takes effect at the start of the next fill_resampled().  If
+ * the cutoff moves far enough to need a new sinc table, this thread builds
+ * it, in whichever of the two tables the audio thread is not using.
+ */
+void request_resample_rate(resampler* r, ALdouble in_rate)
+{
+    const ALdouble cutoff = resample_cutoff(in_rate, r->out_rate);
+    sinc_table* table;
+
+    if (!(in_rate > 0 && in_rate < 4095 * r->out_rate))
+        return;
+    if (r->quality == RESAMPLE_SINC && fabs(cutoff - r->cutoff) > 0.05)
+    {
+        for (;;)
+        { /* Both are NULL only while the audio thread swaps them. */
+            table = (sinc_table *)InterlockedExchangePointer(
+                (PVOID volatile *)&r->pending, NULL);
+            if (table == NULL)
+                table = (sinc_table *)InterlockedExchangePointer(
+                    (PVOID volatile *)&r->spare, NULL);
+            if (table != NULL)
+                break;
+            Sleep(0);
+        }
+        build_sinc_table(table, cutoff);
+        r->cutoff = cutoff;
+        InterlockedExchangePointer((PVOID volatile *)&r->pending, table);
+    }
+    InterlockedExchange(&r->requested, (LONG)(in_rate * 1000 + 0.5));
+    return;
+}
+
+/*
+ * Keep HALF_TAPS frames of history behind the read position, drop the rest
+ * and top up from upstream.  Returns the count of new frames.
+ */
+ALsizei pull_resampler_input(resampler* r)
+{
+    const ALsizei base = r->pos - (HALF_TAPS - 1);
+    ALsizei count, i;
+    register ALsizei c;
+
+    if (base >= r->avail)
+    { /* stepped clean past everything held (a huge downsampling ratio) */
+        r->pos -= r->avail;
+        r->avail = 0;
+    }
+    else if (base > 0)
+    {
+        for (c = 0; c < r->channels; c++)
+            memmove(r->history[c], r->history[c] + base,
+                (r->avail - base) * sizeof(ALfloat));
+        r->pos -= base;
+        r->avail -= base;
+    }
+    count = HISTORY_SIZE - r->avail;
+    if (count > RESAMPLE_CHUNK)
+        count = RESAMPLE_CHUNK;
+    count = r->fill(r->user, r->in_staging, count);
+    if (count <= 0)
+        return 0;
+
+    convert_samples(r->in_float, float_format(r->in_format),
+        r->in_staging, r->in_format, 0, count);
+    for (c = 0; c < r->channels; c++)
+    {
+        ALfloat* dst = r->history[c] + r->avail;
+
+        for (i = 0; i < count; i++)
+            dst[i] = r->in_float[i*r->channels + c];
+    }
+    r->avail += count;
+    return (count);
+}
+
+/*
+ * stream_fill producing float frames at the output rate.
+ * The stream it feeds should be opened with float_format(in_format).
+ */
+ALsizei fill_resampled(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    resampler* r = (resampler *)user;
+    ALfloat* out = (ALfloat *)data;
+    ALsizei done;
+    LONG requested;
+    register ALsizei c;
+
+    requested = InterlockedExchange(&r->requested, 0);
+    if (requested > 0)
+        set_resample_rate(r, requested / 1000.0);
+    if (r->pending != NULL)
+    {
+        sinc_table* table = (sinc_table *)InterlockedExchangePointer(
+            (PVOID volatile *)&r->pending, NULL);
+
+        if (table != NULL)
+        {
+            InterlockedExchangePointer((PVOID volatile *)&r->spare, r->table);
+            r->table = table;
+        }
+    }
+    for (done = 0; done < frames; done++)
+    {
+        const ALfloat t = (r->frac & ((1 << (FRAC_BITS - PHASE_BITS)) - 1))
+            * (1.0F / (1 << (FRAC_BITS - PHASE_BITS)));
+        const ALfloat mu = r->frac * (1.0F / FRAC_ONE);
+
+        while (r->pos + HALF_TAPS >= r->avail)
+            if (pull_resampler_input(r) == 0)
+                return (done); /* upstream is dry */
+
+        for (c = 0; c < r->channels; c++)
+        {
+            const ALfloat* x = r->history[c] + r->pos;
+
+            switch (r->quality)
+            {
+                case RESAMPLE_LINEAR:
+                    *out++ = x[0] + mu*(x[1] - x[0]);
+                    break;
+                case RESAMPLE_CUBIC: /* Catmull-Rom through x[-1]..x[2] */
+                    *out++ = x[0] + 0.5F*mu*(x[1] - x[-1]
+                        + mu*(2*x[-1] - 5*x[0] + 4*x[1] - x[2]
+                        + mu*(3*(x[0] - x[1]) + x[2] - x[-1])));
+                    break;
+                default:
+                {
+                    const ALsizei phase = r->frac >> (FRAC_BITS - PHASE_BITS);
+
+                    *out++ = r->dot(x - (HALF_TAPS - 1),
+                        r->table->coeffs + phase*SINC_TAPS,
+                        r->table->deltas + phase*SINC_TAPS, t);
+                }
+            }
+        }
+
+        r->frac += r->step;
+        r->pos += r->frac >> FRAC_BITS;
+        r->frac &= FRAC_MASK;
+        if (r->ramp > 0 && --r->ramp == 0)
+            r->step = r->target_step;
+        else if (r->ramp > 0)
+            r->step += r->step_delta;
+    }
+    return (done);
+}
@@ -0,0 +1,229 @@
+/*
+ * Lock-free single-producer, single-consumer ring of PCM sample frames.
+ *
+ * An emulator generates audio on its own thread and must never wait on an
+ * OpenAL call or a mutex to hand it over.  The producer only ever writes
+ * `head`, the consumer only ever writes `tail`, so neither needs a lock:
+ * each side publishes its index with a full barrier after touching the data.
+ *
+ * Both indices count frames forever and wrap naturally as unsigned integers.
+ * The capacity is a power of two so that (index & mask) locates the slot.
+ */
+#define CACHE_LINE      64
+
+typedef struct {
+    volatile LONG head; /* next frame the producer writes */
+    ALuint tail_cache; /* producer's last look at `tail` */
+    ALuint overflows; /* producer writes cut short for want of space */
+    ALuint dropped; /* frames the producer could not fit */
+    ALubyte pad0[CACHE_LINE - 4*sizeof(ALuint)];
+
+    volatile LONG tail; /* next frame the consumer reads */
+    ALuint head_cache; /* consumer's last look at `head` */
+    ALuint underflows; /* consumer reads cut short for want of data */
+    ALuint peak; /* highest fill level the consumer has seen */
+    ALubyte pad1[CACHE_LINE - 4*sizeof(ALuint)];
+
+    ALubyte* data;
+    ALuint mask; /* capacity - 1, in frames */
+    ALsizei frame_size;
+} sample_ring;
+
+ALboolean open_ring(sample_ring* ring, ALsizei frames, ALsizei frame_size)
+{
+    ALuint capacity;
+
+    memset(ring, 0, sizeof(sample_ring));
+    for (capacity = 1; capacity < (ALuint)frames; capacity <<= 1)
+        ;
+    ring->data = (ALubyte *)malloc(capacity * frame_size);
+    if (ring->data == NULL)
+    {
+        printf("Failed to allocate %u-frame sample ring.\n", capacity);
+        return AL_FALSE;
+    }
+    ring->mask = capacity - 1;
+    ring->frame_size = frame_size;
+    return AL_TRUE;
+}
+
+void close_ring(sample_ring* ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+    return;
+}
+
+/*
+ * Copy `count` frames between linear memory and the ring, starting at ring
+ * frame `index` and wrapping past the end of the storage if need be.
+ */
+void ring_copy(
+    sample_ring* ring, ALuint index, ALubyte* linear, ALsizei count,
+    ALboolean to_ring)
+{
+    const ALuint start = index & ring->mask;
+    ALuint first = ring->mask + 1 - start;
+    ALubyte* slot = ring->data + start*ring->frame_size;
+
+    if (first > (ALuint)count)
+        first = count;
+    if (to_ring)
+    {
+        memcpy(slot, linear, first * ring->frame_size);
+        memcpy(ring->data, linear + first*ring->frame_size,
+            (count - first) * ring->frame_size);
+    }
+    else
+    {
+        memcpy(linear, slot, first * ring->frame_size);
+        memcpy(linear + first*ring->frame_size, ring->data,
+            (count - first) * ring->frame_size);
+    }
+    return;
+}
+
+/*
+ * Producer side.  Never blocks:  whatever does not fit is dropped and
+ * counted as an overflow.  Returns the count of frames actually written.
+ */
+ALsizei ring_write(sample_ring* ring, const ALvoid* data, ALsizei frames)
+{
+    const ALuint head = (ALuint)ring->head;
+    ALuint space;
+
+    space = ring->mask + 1 - (head - ring->tail_cache);
+    if (space < (ALuint)frames)
+    { /* Only touch the consumer's cache line when we seem to be full. */
+        ring->tail_cache = (ALuint)ring->tail;
+        space = ring->mask + 1 - (head - ring->tail_cache);
+    }
+    if (space < (ALuint)frames)
+    {
+        ++ring->overflows;
+        ring->dropped += frames - space;
+        frames = space;
+    }
+    if (frames <= 0)
+        return 0;
+    ring_copy(ring, head, (ALubyte *)data, frames, AL_TRUE);
+    InterlockedExchange(&ring->head, (LONG)(head + frames));
+    return (frames);
+}
+
+/*
+ * Consumer side.  Returns the count of frames actually read, which falls
+ * short of `frames` (counting an underflow) if the producer fell behind.
+ */
+ALsizei ring_read(sample_ring* ring, ALvoid* data, ALsizei frames)
+{
+    const ALuint tail = (ALuint)ring->tail;
+    ALuint level;
+
+    level = ring->head_cache - tail;
+    if (level < (ALuint)frames)
+    {
+        ring->head_cache = (ALuint)ring->head;
+        level = ring->head_cache - tail;
+    }
+    if (level > ring->peak)
+        ring->peak = level;
+    if (level < (ALuint)frames)
+    {
+        ++ring->underflows;
+        frames = level;
+    }
+    if (frames <= 0)
+        return 0;
+    ring_copy(ring, tail, (ALubyte *)data, frames, AL_FALSE);
+    InterlockedExchange(&ring->tail, (LONG)(tail + frames));
+    return (frames);
+}
+
+/*
+ * How many frames are waiting for the consumer.  Safe from either thread,
+ * though the answer may be stale by the time the caller looks at it.
+ */
+ALsizei ring_fill_level(const sample_ring* ring)
+{
+    return (ALsizei)((ALuint)ring->head - (ALuint)ring->tail);
+}
+
+ALsizei ring_capacity(const sample_ring* ring)
+{
+    return (ALsizei)(ring->mask + 1);
+}
+
+/*
+ * stream_fill adapter so that an AL_stream drains the ring.
+ */
+ALsizei fill_from_ring(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    return ring_read((sample_ring *)user, data, frames);
+}
+
+/*
+ * Dedicated audio thread:  the only thread that feeds AL buffers, so that
+ * the producer never waits on alBufferData or alSourceQueueBuffers.  It
+ * sleeps until stream_events says a buffer is due.
+ */
+typedef struct {
+    AL_stream* stream;
+    stream_events* events;
+    queue_tuner* tuner; /* optional */
+    HANDLE thread;
+    volatile LONG quit;
+} audio_thread;
+
+DWORD WINAPI audio_thread_main(LPVOID param)
+{
+    audio_thread* audio = (audio_thread *)param;
+
+    while (audio->quit == 0)
+    {
+        const ALint refilled = update_stream(audio->stream);
+
+        if (audio->tuner != NULL)
+            adapt_queue(audio->tuner, audio->stream, audio->events, refilled);
+        wait_stream_event(audio->events,
+            next_stream_wait(audio->events, audio->stream, refilled), NULL);
+    }
+    flush_block_cache(&pcm_arena);
+    return 0;
+}
+
+ALboolean start_audio_thread(audio_thread* audio, AL_stream* stream,
+    stream_events* events, queue_tuner* tuner)
+{
+    audio->stream = stream;
+    audio->events = events;
+    audio->tuner = tuner;
+    audio->quit = 0;
+    audio->thread = CreateThread(NULL, 0, audio_thread_main, audio, 0, NULL);
+    if (audio->thread == NULL)
+    {
+        printf("Failed to create the audio thread.\n");
+        return AL_FALSE;
+    }
+    SetThreadPriority(audio->thread, THREAD_PRIORITY_TIME_CRITICAL);
+    return AL_TRUE;
+}
+
+void stop_audio_thread(audio_thread* audio)
+{
+    InterlockedExchange(&audio->quit, 1);
+    wake_stream(audio->events);
+    WaitForSingleObject(audio->thread, INFINITE);
+    CloseHandle(audio->thread);
+    return;
+}
+
+void log_ring_counters(const sample_ring* ring)
+{
+    printf("Sample ring:  %i of %i frames filled (peak %u).\n",
+        ring_fill_level(ring), ring_capacity(ring), ring->peak);
+    printf("Overflows:  %u (%u frames dropped)\n",
+        ring->overflows, ring->dropped);
+    printf("Underflows:  %u\n", ring->underflows);
+    return;
+}
@@ -0,0 +1,410 @@
+/*
+ * A scene of many more positional emitters than there are voices.
+ *
+ * Emitters are kept as a structure of arrays:  all X coordinates together,
+ * then all Y, and so on, so that one pass computes the distance attenuation
+ * of four (SSE2) or eight (AVX2) emitters per step under the context's
+ * AL_DISTANCE_MODEL, with each emitter's AL_REFERENCE_DISTANCE,
+ * AL_ROLLOFF_FACTOR and AL_MAX_DISTANCE.
+ *
+ * Whatever comes out under the cull gain loses its voice back to the pool,
+ * and costs no AL call at all until it gets loud enough again; it only
+ * gets a voice back once it clears the cull gain, and only loses it again
+ * below half of that, so emitters at the edge do not flap.  The survivors
+ * have their voices moved through the update batch, so only the positions
+ * and gains that really changed reach AL, all in one deferred commit.
+ */
+#include <float.h>
+
+#define MAX_EMITTERS    4096
+#define CULL_GAIN       0.01F /* -40 dB */
+
+typedef struct scene scene;
+typedef void (*attenuate_kernel)(scene* world, const ALfloat* at,
+    ALsizei first, ALsizei count);
+
+struct scene {
+    ALsizei count;
+    ALfloat* x; /* positions */
+    ALfloat* y;
+    ALfloat* z;
+    ALfloat* gain; /* AL_GAIN before attenuation */
+    ALfloat* reference; /* AL_REFERENCE_DISTANCE */
+    ALfloat* rolloff; /* AL_ROLLOFF_FACTOR */
+    ALfloat* max_distance; /* AL_MAX_DISTANCE */
+    ALfloat* heard; /* gain after attenuation, from the last update */
+    ALuint* buffer;
+    ALint* priority;
+    voice_handle* voice; /* 0 while culled */
+
+    voice_pool* pool;
+    update_batch* batch;
+    source_shadow shadows[MAX_VOICES]; /* by voice index */
+    ALenum model; /* AL_DISTANCE_MODEL as of the last update */
+    attenuate_kernel attenuate;
+    const char* kernels;
+
+    ALsizei voiced; /* emitters holding a voice after the last update */
+    ALuint updates;
+    ALuint starts; /* voices taken on by emitters growing audible */
+    ALuint stops; /* voices given up by emitters fading out */
+};
+
+/*
+ * OpenAL 1.1, section 3.4:  the gain factor at `distance`.
+ */
+ALfloat distance_gain(ALenum model, ALfloat distance, ALfloat reference,
+    ALfloat rolloff, ALfloat max_distance)
+{
+    ALfloat gain;
+
+    switch (model)
+    {
+    case AL_INVERSE_DISTANCE_CLAMPED:
+    case AL_LINEAR_DISTANCE_CLAMPED:
+    case AL_EXPONENT_DISTANCE_CLAMPED:
+        if (distance < reference)
+            distance = reference;
+        if (distance > max_distance)
+            distance = max_distance;
+    }
+    switch (model)
+    {
+    case AL_INVERSE_DISTANCE:
+    case AL_INVERSE_DISTANCE_CLAMPED:
+        gain = reference + rolloff * (distance - reference);
+        return (gain > 1e-6F) ? reference / gain : 1.0F;
+    case AL_LINEAR_DISTANCE:
+    case AL_LINEAR_DISTANCE_CLAMPED:
+        if (distance > max_distance)
+            distance = max_distance;
+        if (max_distance <= reference)
+            return 1.0F;
+        gain = 1.0F - rolloff * (distance - reference)
+            / (max_distance - reference);
+        return (gain > 0.0F) ? gain : 0.0F;
+    case AL_EXPONENT_DISTANCE:
+    case AL_EXPONENT_DISTANCE_CLAMPED:
+        if (distance <= 0.0F || reference <= 0.0F)
+            return 1.0F;
+        return (ALfloat)pow(distance / reference, -rolloff);
+    }
+    return 1.0F; /* AL_NONE */
+}
+
+/*
+ * scalar kernel, for every model and for the tails of the vector kernels
+ */
+void attenuate_C(scene* world, const ALfloat* at, ALsizei first,
+    ALsizei count)
+{
+    register ALsizei i;
+
+    for (i = first; i < count; i++)
+    {
+        const ALfloat dx = world->x[i] - at[0];
+        const ALfloat dy = world->y[i] - at[1];
+        const ALfloat dz = world->z[i] - at[2];
+        ALfloat gain = world->gain[i] * distance_gain(world->model,
+            (ALfloat)sqrt(dx*dx + dy*dy + dz*dz), world->reference[i],
+            world->rolloff[i], world->max_distance[i]);
+
+        world->heard[i] = (gain < 1.0F) ? gain : 1.0F; /* AL_MAX_GAIN */
+    }
+    return;
+}
+
+#define MODEL_CLAMPED(model) ((model) == AL_INVERSE_DISTANCE_CLAMPED \
+                           || (model) == AL_LINEAR_DISTANCE_CLAMPED)
+#define MODEL_LINEAR(model)  ((model) == AL_LINEAR_DISTANCE \
+                           || (model) == AL_LINEAR_DISTANCE_CLAMPED)
+
+#ifdef CONVERT_SIMD
+/*
+ * SSE2 kernel, four emitters per step
+ * The exponent models need pow(), which has no vector form here, so they
+ * stay scalar.
+ */
+void attenuate_SSE2(scene* world, const ALfloat* at, ALsizei first,
+    ALsizei count)
+{
+    const __m128 lx = _mm_set1_ps(at[0]);
+    const __m128 ly = _mm_set1_ps(at[1]);
+    const __m128 lz = _mm_set1_ps(at[2]);
+    const __m128 one = _mm_set1_ps(1.0F);
+    const __m128 tiny = _mm_set1_ps(1e-6F);
+    const ALenum model = world->model;
+    register ALsizei i;
+
+    if (model != AL_NONE && model != AL_INVERSE_DISTANCE
+     && model != AL_INVERSE_DISTANCE_CLAMPED && !MODEL_LINEAR(model))
+    {
+        attenuate_C(world, at, first, count);
+        return;
+    }
+    for (i = first; i + 4 <= count; i += 4)
+    {
+        const __m128 dx = _mm_sub_ps(_mm_loadu_ps(world->x + i), lx);
+        const __m128 dy = _mm_sub_ps(_mm_loadu_ps(world->y + i), ly);
+        const __m128 dz = _mm_sub_ps(_mm_loadu_ps(world->z + i), lz);
+        const __m128 ref = _mm_loadu_ps(world->reference + i);
+        const __m128 roll = _mm_loadu_ps(world->rolloff + i);
+        const __m128 far = _mm_loadu_ps(world->max_distance + i);
+        __m128 d, g;
+
+        d = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        if (MODEL_CLAMPED(model))
+            d = _mm_max_ps(_mm_min_ps(d, far), ref);
+        if (model == AL_NONE)
+            g = one;
+        else if (MODEL_LINEAR(model))
+        {
+            d = _mm_min_ps(d, far);
+            g = _mm_div_ps(_mm_mul_ps(roll, _mm_sub_ps(d, ref)),
+                _mm_max_ps(_mm_sub_ps(far, ref), tiny));
+            g = _mm_max_ps(_mm_sub_ps(one, g), _mm_setzero_ps());
+        }
+        else
+            g = _mm_div_ps(ref, _mm_max_ps(
+                _mm_add_ps(ref, _mm_mul_ps(roll, _mm_sub_ps(d, ref))), tiny));
+        g = _mm_mul_ps(g, _mm_loadu_ps(world->gain + i));
+        _mm_storeu_ps(world->heard + i, _mm_min_ps(g, one));
+    }
+    attenuate_C(world, at, i, count);
+    return;
+}
+
+/*
+ * AVX2 kernel, eight emitters per step
+ */
+TARGET_AVX2
+void attenuate_AVX2(scene* world, const ALfloat* at, ALsizei first,
+    ALsizei count)
+{
+    const __m256 lx = _mm256_set1_ps(at[0]);
+    const __m256 ly = _mm256_set1_ps(at[1]);
+    const __m256 lz = _mm256_set1_ps(at[2]);
+    const __m256 one = _mm256_set1_ps(1.0F);
+    const __m256 tiny = _mm256_set1_ps(1e-6F);
+    const ALenum model = world->model;
+    register ALsizei i;
+
+    if (model != AL_NONE && model != AL_INVERSE_DISTANCE
+     && model != AL_INVERSE_DISTANCE_CLAMPED && !MODEL_LINEAR(model))
+    {
+        attenuate_C(world, at, first, count);
+        return;
+    }
+    for (i = first; i + 8 <= count; i += 8)
+    {
+        const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(world->x + i), lx);
+        const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(world->y + i), ly);
+        const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(world->z + i), lz);
+        const __m256 ref = _mm256_loadu_ps(world->reference + i);
+        const __m256 roll = _mm256_loadu_ps(world->rolloff + i);
+        const __m256 far = _mm256_loadu_ps(world->max_distance + i);
+        __m256 d, g;
+
+        d = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(
+            _mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+            _mm256_mul_ps(dz, dz)));
+        if (MODEL_CLAMPED(model))
+            d = _mm256_max_ps(_mm256_min_ps(d, far), ref);
+        if (model == AL_NONE)
+            g = one;
+        else if (MODEL_LINEAR(model))
+        {
+            d = _mm256_min_ps(d, far);
+            g = _mm256_div_ps(_mm256_mul_ps(roll, _mm256_sub_ps(d, ref)),
+                _mm256_max_ps(_mm256_sub_ps(far, ref), tiny));
+            g = _mm256_max_ps(_mm256_sub_ps(one, g), _mm256_setzero_ps());
+        }
+        else
+            g = _mm256_div_ps(ref, _mm256_max_ps(_mm256_add_ps(ref,
+                _mm256_mul_ps(roll, _mm256_sub_ps(d, ref))), tiny));
+        g = _mm256_mul_ps(g, _mm256_loadu_ps(world->gain + i));
+        _mm256_storeu_ps(world->heard + i, _mm256_min_ps(g, one));
+    }
+    attenuate_C(world, at, i, count);
+    return;
+}
+#endif
+
+void close_scene(scene* world)
+{
+    register ALsizei i;
+
+    for (i = 0; i < world->count; i++)
+        if (voice_source(world->pool, world->voice[i]) != 0)
+        {
+            alSourcei(voice_source(world->pool, world->voice[i]),
+                AL_LOOPING, AL_FALSE);
+            stop_voice(world->pool, world->voice[i]);
+        }
+    free(world->x); /* the one block holding every array */
+    memset(world, 0, sizeof(scene));
+    return;
+}
+
+/*
+ * Room for `count` emitters, all silent at the origin until placed with
+ * place_emitter().  Voices come from `pool`, changes go through `batch`.
+ */
+ALboolean open_scene(scene* world, voice_pool* pool, update_batch* batch,
+    ALsizei count)
+{
+    ALubyte* block;
+#ifdef CONVERT_SIMD
+    const int features = detect_CPU_features();
+#endif
+
+    memset(world, 0, sizeof(scene));
+    if (count <= 0 || count > MAX_EMITTERS)
+    {
+        printf("A scene holds 1 to %i emitters.\n", MAX_EMITTERS);
+        return AL_FALSE;
+    }
+    block = (ALubyte *)calloc(count, 8*sizeof(ALfloat)
+        + sizeof(ALuint) + sizeof(ALint) + sizeof(voice_handle));
+    if (block == NULL)
+    {
+        printf("Failed to allocate scene memory.\n");
+        return AL_FALSE;
+    }
+    world->x = (ALfloat *)block;
+    world->y = world->x + count;
+    world->z = world->y + count;
+    world->gain = world->z + count;
+    world->reference = world->gain + count;
+    world->rolloff = world->reference + count;
+    world->max_distance = world->rolloff + count;
+    world->heard = world->max_distance + count;
+    world->buffer = (ALuint *)(world->heard + count);
+    world->priority = (ALint *)(world->buffer + count);
+    world->voice = (voice_handle *)(world->priority + count);
+    world->count = count;
+    world->pool = pool;
+    world->batch = batch;
+
+    world->attenuate = attenuate_C;
+    world->kernels = "scalar";
+#ifdef CONVERT_SIMD
+    if (features & CPU_AVX2)
+    {
+        world->attenuate = attenuate_AVX2;
+        world->kernels = "AVX2";
+    }
+    else if (features & CPU_SSE2)
+    {
+        world->attenuate = attenuate_SSE2;
+        world->kernels = "SSE2";
+    }
+#endif
+    return AL_TRUE;
+}
+
+/*
+ * Set up emitter `i` to loop `buf`, with the AL source defaults for the
+ * distance parameters.
+ */
+void place_emitter(scene* world, ALsizei i, ALuint buf, ALint priority,
+    ALfloat x, ALfloat y, ALfloat z)
+{
+    world->x[i] = x;
+    world->y[i] = y;
+    world->z[i] = z;
+    world->gain[i] = 1.0F;
+    world->reference[i] = 1.0F;
+    world->rolloff[i] = 1.0F;
+    world->max_distance[i] = FLT_MAX;
+    world->buffer[i] = buf;
+    world->priority[i] = priority;
+    return;
+}
+
+/*
+ * Give emitter `i` a voice, set up for its distance parameters and position
+ * before it starts, so the first mix already hears it from the right place.
+ */
+void voice_emitter(scene* world, ALsizei i)
+{
+    ALuint src;
+    ALsizei index;
+    ALboolean queued;
+
+    world->voice[i] = claim_voice(world->pool, world->buffer[i],
+        world->gain[i], world->priority[i], NULL);
+    index = voice_index(world->pool, world->voice[i]);
+    if (index < 0)
+        return;
+    src = world->pool->sources[index];
+    alSourcei(src, AL_LOOPING, AL_TRUE);
+    alSourcef(src, AL_REFERENCE_DISTANCE, world->reference[i]);
+    alSourcef(src, AL_ROLLOFF_FACTOR, world->rolloff[i]);
+    alSourcef(src, AL_MAX_DISTANCE, world->max_distance[i]);
+    alSource3f(src, AL_POSITION, world->x[i], world->y[i], world->z[i]);
+    alSourcePlay(src);
+    queued = world->shadows[index].queued; /* stolen from another emitter */
+    init_source_shadow(&world->shadows[index], src);
+    world->shadows[index].queued = queued;
+    ++world->starts;
+    return;
+}
+
+/*
+ * Re-cull the whole scene around a listener at `at`, then commit the
+ * surviving voices' changes, and the listener's, in one batch.
+ */
+void update_scene(scene* world, const ALfloat* at)
+{
+    register ALsizei i;
+
+    world->model = alGetInteger(AL_DISTANCE_MODEL);
+    world->attenuate(world, at, 0, world->count);
+    world->voiced = 0;
+    for (i = 0; i < world->count; i++)
+    {
+        const ALfloat heard = world->heard[i];
+        ALsizei index = voice_index(world->pool, world->voice[i]);
+
+        if (index < 0)
+            world->voice[i] = 0; /* stolen, or never had one */
+        if (heard < CULL_GAIN * (index < 0 ? 1.0F : 0.5F))
+        {
+            if (index >= 0)
+            {
+                alSourcei(world->pool->sources[index], AL_LOOPING, AL_FALSE);
+                stop_voice(world->pool, world->voice[i]);
+                world->voice[i] = 0;
+                ++world->stops;
+            }
+            continue;
+        }
+        if (index < 0)
+        {
+            voice_emitter(world, i);
+            index = voice_index(world->pool, world->voice[i]);
+            if (index < 0)
+                continue; /* every voice is busy with something louder */
+        }
+        world->pool->gain[index] = heard; /* the quietest gets stolen */
+        batch_source3f(world->batch, &world->shadows[index], AL_POSITION,
+            world->x[i], world->y[i], world->z[i]);
+        batch_sourcef(world->batch, &world->shadows[index], AL_GAIN,
+            world->gain[i]);
+        ++world->voiced;
+    }
+    batch_listenerfv(world->batch, AL_POSITION, at);
+    commit_updates(world->batch);
+    ++world->updates;
+    return;
+}
+
+void log_scene(const scene* world)
+{
+    printf("Scene (%s):  %i of %i emitters voiced, %u updates, "
+        "%u voice starts, %u culled\n", world->kernels, world->voiced,
+        world->count, world->updates, world->starts, world->stops);
+    return;
+}
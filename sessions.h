@@ -0,0 +1,121 @@
+/*
+ * Several independent audio sessions in one process, one thread apiece.
+ *
+ * A session is a device with a context of its own, driven entirely from
+ * its own thread.  alcMakeContextCurrent() is process-wide, so threads
+ * sharing it would keep switching each other's context away; instead each
+ * session thread binds its context with alcSetThreadContext()
+ * (ALC_EXT_thread_local_context), and no session ever waits on another.
+ *
+ * The sessions here are loopback devices, each mixing one benchmark case
+ * of SESSION_SOURCES looping sources, so the scaling across cores can be
+ * measured with no sound card:  one session alone first, then twice as
+ * many at once each round, up to the count asked for.  Until the cores run
+ * out, the total rendering rate should grow with the session count.
+ */
+#define MAX_SESSIONS    64
+#define SESSION_SOURCES 32
+#define SESSION_UPDATE  1024 /* frames mixed per alcRenderSamplesSOFT call */
+
+typedef struct {
+    bench_case test;
+    HANDLE thread;
+    HANDLE start; /* set once every session of the round is running */
+    ALboolean passed;
+} audio_session;
+
+DWORD WINAPI session_main(LPVOID param)
+{
+    audio_session* session = (audio_session *)param;
+
+    WaitForSingleObject(session->start, INFINITE);
+    session->passed = run_bench_case(&session->test);
+    return 0;
+}
+
+/*
+ * Run `count` sessions at once.  Returns the total of their rendering
+ * rates, in sample frames per second, or 0 if any of them failed.
+ */
+ALdouble run_sessions(audio_session* sessions, ALsizei count)
+{
+    HANDLE start, threads[MAX_SESSIONS];
+    ALdouble rate;
+    register ALsizei i;
+
+    start = CreateEvent(NULL, TRUE, FALSE, NULL); /* manual reset */
+    if (start == NULL)
+        return 0.0;
+    for (i = 0; i < count; i++)
+    {
+        audio_session* session = &sessions[i];
+
+        memset(session, 0, sizeof(audio_session));
+        session->test.sources = SESSION_SOURCES;
+        session->test.update = SESSION_UPDATE;
+        session->test.format = AL_FORMAT_MONO16;
+        session->test.format_name = "mono16";
+        session->test.pitch = 1.0F;
+        session->start = start;
+        session->thread = CreateThread(NULL, 0, session_main, session, 0,
+            NULL);
+        if (session->thread == NULL)
+            break;
+        threads[i] = session->thread;
+    }
+    SetEvent(start); /* all together, so that they really do overlap */
+    if (i > 0)
+        WaitForMultipleObjects(i, threads, TRUE, INFINITE);
+
+    rate = (i == count) ? 0.0 : -1.0; /* not every thread started */
+    while (i-- > 0)
+    {
+        CloseHandle(sessions[i].thread);
+        if (sessions[i].passed == AL_FALSE || sessions[i].test.seconds <= 0)
+            rate = -1.0;
+        else if (rate >= 0.0)
+            rate += sessions[i].test.frames / sessions[i].test.seconds;
+    }
+    CloseHandle(start);
+    return (rate < 0.0) ? 0.0 : rate;
+}
+
+int run_session_scaling(ALsizei most)
+{
+    static audio_session sessions[MAX_SESSIONS];
+    ALdouble alone = 0.0;
+    ALsizei count;
+
+    if (most < 1 || most > MAX_SESSIONS)
+    {
+        printf("Run 1 to %i sessions at once.\n", MAX_SESSIONS);
+        return 1;
+    }
+    if (load_loopback_functions() == AL_FALSE)
+        return 1;
+    if (alcSetThreadContext == NULL)
+    {
+        printf("Failed to detect extension:  %s.\n",
+            "ALC_EXT_thread_local_context");
+        return 1;
+    }
+    printf("%8s %12s %9s %10s\n", "sessions", "frames/s", "realtime",
+        "scaling");
+    for (count = 1; ; count = (2*count < most) ? 2*count : most)
+    {
+        const ALdouble rate = run_sessions(sessions, count);
+
+        if (rate <= 0.0)
+        {
+            printf("%8i failed\n", count);
+            return 1;
+        }
+        if (count == 1)
+            alone = rate;
+        printf("%8i %12.0f %8.1fx %9.0f%%\n", count, rate,
+            rate / BENCH_RATE, 100.0 * rate / (alone * count));
+        if (count == most)
+            break;
+    }
+    return 0;
+}
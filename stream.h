@@ -0,0 +1,620 @@
+/*
+ * Buffer-queue streaming of continuous audio through one AL source.
+ *
+ * Instead of looping one static buffer holding the whole sound, the source
+ * cycles through a ring of `depth` small buffers of `frames` sample frames.
+ * Each time AL_BUFFERS_PROCESSED reports finished buffers, they get unqueued,
+ * refilled by the producer and requeued at the tail of the source queue.
+ *
+ * Queue latency is roughly (depth * frames / frequency) seconds, so both are
+ * chosen at run-time:  more or bigger buffers trade latency for fewer gaps.
+ * limit_stream() narrows either one below what was allocated, so that a
+ * controller can move along that trade-off while the stream plays.
+ *
+ * pull_stream() switches a stream over to AL_SOFT_callback_buffer instead:
+ * the mixer calls the producer from its own thread for exactly the samples
+ * it is about to mix, so nothing sits queued ahead of the device period.
+ *
+ * map_stream() keeps every buffer persistently mapped (AL_SOFT_map_buffer)
+ * instead, so producers and conversions write straight into AL's storage
+ * rather than into staging memory that alBufferData then copies again.
+ */
+#define MAX_QUEUE_DEPTH 64
+
+/*
+ * The producer writes up to `frames` sample frames into `data` and returns
+ * how many it really wrote.  Returning 0 means no more audio for now.
+ */
+typedef ALsizei (*stream_fill)(ALvoid* user, ALvoid* data, ALsizei frames);
+
+/*
+ * Zero-copy alternative:  the producer points `data` at up to `frames`
+ * contiguous sample frames it already holds (a mapped file, for instance),
+ * which go to alBufferData as they are, skipping the staging area.  Short
+ * runs cost a copy after all, to gather a whole buffer from several.
+ */
+typedef ALsizei (*stream_peek)(
+    ALvoid* user, const ALvoid** data, ALsizei frames);
+
+typedef struct {
+    ALuint source;
+    ALuint buffers[MAX_QUEUE_DEPTH];
+    ALuint idle[MAX_QUEUE_DEPTH]; /* unqueued buffers the producer left empty */
+    ALsizei idle_count;
+    ALsizei depth; /* count of AL buffers owned by the stream */
+    ALsizei frames; /* sample frames per buffer (BUFFER_SIZE by default) */
+    ALsizei active; /* buffers kept queued, at most `depth` */
+    ALsizei chunk; /* sample frames per refill, at most `frames` */
+    ALsizei frame_size; /* bytes per sample frame in `format` */
+    ALenum format; /* what the producer hands us */
+    ALenum out_format; /* what goes to alBufferData */
+    ALuint flags; /* SAMPLE_* quirks of the producer's 16-bit samples */
+    ALsizei frequency;
+    ALubyte* staging; /* refill scratch area, one buffer large */
+    ALubyte* converted; /* out_format scratch area, if converting */
+    ALvoid* mapped[MAX_QUEUE_DEPTH]; /* each of `buffers`, if map_stream() */
+    ALsizei mapped_frames[MAX_QUEUE_DEPTH]; /* frames of storage in each */
+    stream_fill fill;
+    stream_peek peek; /* If set, used instead of `fill`. */
+    ALvoid* user;
+    volatile ALboolean playing; /* Should the source be playing right now? */
+    ALboolean pull; /* mixer-driven through a buffer callback, not queued */
+    ALboolean map; /* refilled through `mapped`, not alBufferData */
+    stream_metrics* metrics; /* optional timing instrumentation */
+    ALuint refills;
+    ALuint underruns;
+} AL_stream;
+
+LPALBUFFERSTORAGESOFT alBufferStorageSOFT;
+LPALMAPBUFFERSOFT alMapBufferSOFT;
+LPALUNMAPBUFFERSOFT alUnmapBufferSOFT;
+LPALFLUSHMAPPEDBUFFERSOFT alFlushMappedBufferSOFT;
+
+#define MAP_FLAGS       (AL_MAP_READ_BIT_SOFT | AL_MAP_WRITE_BIT_SOFT \
+                       | AL_MAP_PERSISTENT_BIT_SOFT)
+
+/*
+ * (Re)allocate the storage of buffer `slot` at `frames` frames, from `data`
+ * if not NULL, and map all of it while it stays queued:  for writing, and
+ * for reading back a short refill to store anew.
+ */
+ALboolean store_mapped(AL_stream* stream, ALsizei slot, ALsizei frames,
+    const ALvoid* data)
+{
+    const ALuint buf = stream->buffers[slot];
+    const ALsizei size = frames * format_frame_size(stream->out_format);
+
+    if (stream->mapped[slot] != NULL)
+        alUnmapBufferSOFT(buf);
+    stream->mapped[slot] = NULL;
+    stream->mapped_frames[slot] = 0;
+    alBufferStorageSOFT(buf, stream->out_format, data, size,
+        stream->frequency, MAP_FLAGS);
+    stream->mapped[slot] = alMapBufferSOFT(buf, 0, size, MAP_FLAGS);
+    if (stream->mapped[slot] == NULL)
+        return AL_FALSE;
+    stream->mapped_frames[slot] = frames;
+    return AL_TRUE;
+}
+
+/*
+ * refill_buffer() for mapped buffers:  the producer writes into the
+ * mapping itself, or the conversion does, so each sample is written once.
+ * The storage is exactly one chunk long, so a producer coming up short
+ * costs a copy after all:  the frames it did write get stored anew.
+ */
+ALsizei refill_mapped(AL_stream* stream, ALsizei slot)
+{
+    const ALsizei out_size = format_frame_size(stream->out_format);
+    const ALboolean direct = (stream->out_format == stream->format
+                           && stream->flags == 0);
+    ALubyte* out;
+    ALsizei written;
+    LONGLONG start;
+
+    if (stream->mapped_frames[slot] != stream->chunk)
+        if (store_mapped(stream, slot, stream->chunk, NULL) == AL_FALSE)
+            return 0;
+    out = (ALubyte *)stream->mapped[slot];
+    for (written = 0; written < stream->chunk; )
+    {
+        const ALvoid* in = stream->staging;
+        ALsizei got;
+
+        if (stream->peek != NULL)
+            got = stream->peek(stream->user, &in,
+                stream->chunk - written);
+        else if (direct)
+        {
+            in = NULL; /* already in place */
+            got = stream->fill(stream->user, out + written * out_size,
+                stream->chunk - written);
+        }
+        else
+            got = stream->fill(stream->user, stream->staging,
+                stream->chunk - written);
+        if (got <= 0)
+            break;
+        if (in != NULL && direct)
+            memcpy(out + written * out_size, in, got * out_size);
+        else if (in != NULL)
+            convert_samples(out + written * out_size, stream->out_format,
+                in, stream->format, stream->flags, got);
+        written += got;
+    }
+    if (written == 0)
+        return 0;
+
+    start = (stream->metrics != NULL) ? ticks_now() : 0;
+    if (written < stream->chunk)
+    {
+        ALubyte* scratch = (stream->converted != NULL)
+            ? stream->converted : stream->staging;
+
+        memcpy(scratch, out, written * out_size);
+        if (store_mapped(stream, slot, written, scratch) == AL_FALSE)
+            written = 0;
+    }
+    else
+        alFlushMappedBufferSOFT(stream->buffers[slot], 0,
+            written * out_size);
+    if (stream->metrics != NULL)
+        record_histogram(&stream->metrics->upload,
+            ticks_to_us(ticks_now() - start));
+    if (written > 0)
+        ++stream->refills;
+    return (written);
+}
+
+/*
+ * A peek came up short of the chunk, as ADPCM's do at the end of every
+ * block:  copy it to `staging` and top it up from further peeks, so that
+ * the AL buffer still gets a whole chunk.  Returns the frames gathered.
+ */
+ALsizei gather_peeks(AL_stream* stream, const ALvoid* data, ALsizei got)
+{
+    ALsizei written = got;
+
+    memmove(stream->staging, data, got * stream->frame_size);
+    while (written < stream->chunk)
+    {
+        got = stream->peek(stream->user, &data, stream->chunk - written);
+        if (got <= 0)
+            break;
+        memcpy(stream->staging + written * stream->frame_size, data,
+            got * stream->frame_size);
+        written += got;
+    }
+    return (written);
+}
+
+/*
+ * Run the producer for one buffer and upload whatever it wrote.
+ * Returns the count of sample frames now stored in the AL buffer.
+ */
+ALsizei refill_buffer(AL_stream* stream, ALuint buf)
+{
+    const ALvoid* data;
+    ALsizei written;
+    LONGLONG start;
+    register ALsizei slot;
+
+    if (stream->map)
+    {
+        for (slot = 0; stream->buffers[slot] != buf; slot++);
+        return refill_mapped(stream, slot);
+    }
+    data = stream->staging;
+    if (stream->peek != NULL)
+    {
+        written = stream->peek(stream->user, &data, stream->chunk);
+        if (written > 0 && written < stream->chunk)
+        {
+            written = gather_peeks(stream, data, written);
+            data = stream->staging;
+        }
+    }
+    else
+        written = stream->fill(stream->user, stream->staging, stream->chunk);
+    if (written <= 0)
+        return 0;
+    start = (stream->metrics != NULL) ? ticks_now() : 0;
+    convert_buffer_data(buf, stream->out_format, data, stream->format,
+        stream->flags, written, stream->frequency, stream->converted);
+    if (stream->metrics != NULL)
+        record_histogram(&stream->metrics->upload,
+            ticks_to_us(ticks_now() - start));
+    ++stream->refills;
+    return (written);
+}
+
+/*
+ * On failure, nothing is left allocated and `stream->depth` is 0.
+ */
+ALboolean open_stream(
+    AL_stream* stream, ALuint source, ALenum format, ALsizei frequency,
+    ALsizei depth, ALsizei frames, stream_fill fill, ALvoid* user)
+{
+    ALenum ALstatus;
+    register ALsizei i;
+
+    memset(stream, 0, sizeof(AL_stream));
+    if (depth < 2 || depth > MAX_QUEUE_DEPTH)
+    {
+        printf("Queue depth must be 2 to %i buffers.\n", MAX_QUEUE_DEPTH);
+        return AL_FALSE;
+    }
+    stream->frame_size = format_frame_size(format);
+    if (stream->frame_size == 0 || frames <= 0)
+    {
+        printf("Cannot stream AL format 0x%04X.\n", format);
+        return AL_FALSE;
+    }
+    stream->source = source;
+    stream->depth = depth;
+    stream->frames = frames;
+    stream->active = depth;
+    stream->chunk = frames;
+    stream->format = format;
+    stream->out_format = format;
+    stream->frequency = frequency;
+    stream->fill = fill;
+    stream->user = user;
+    stream->staging = (ALubyte *)pcm_alloc(frames * stream->frame_size);
+    if (stream->staging == NULL)
+    {
+        printf("Failed to allocate stream staging memory.\n");
+        memset(stream, 0, sizeof(AL_stream));
+        return AL_FALSE;
+    }
+
+    alGetError();
+    alGenBuffers(depth, stream->buffers);
+    ALstatus = alGetError();
+    if (ALstatus != AL_NO_ERROR)
+    {
+        printf("alGenBuffers:  0x%04X\n", ALstatus);
+        pcm_free(stream->staging);
+        memset(stream, 0, sizeof(AL_stream));
+        return AL_FALSE;
+    }
+
+/*
+ * A looping source would replay the whole queue instead of waiting on us,
+ * and a static AL_BUFFER binding cannot coexist with queued buffers.
+ *
+ * Every buffer starts out idle; the first update_stream() primes the queue,
+ * so the caller has a chance to switch the stream over to `peek` first.
+ */
+    alSourcei(source, AL_LOOPING, AL_FALSE);
+    alSourcei(source, AL_BUFFER, AL_NONE);
+    for (i = 0; i < depth; i++)
+        stream->idle[stream->idle_count++] = stream->buffers[depth - 1 - i];
+    ALstatus = alGetError();
+    if (ALstatus != AL_NO_ERROR)
+    {
+        printf("alSource:  0x%04X\n", ALstatus);
+        alDeleteBuffers(depth, stream->buffers);
+        pcm_free(stream->staging);
+        memset(stream, 0, sizeof(AL_stream));
+        return AL_FALSE;
+    }
+    return AL_TRUE;
+}
+
+/*
+ * Keep only `active` buffers queued, of `chunk` frames each, clamped to what
+ * open_stream() allocated.  Takes effect with the next refill; buffers over
+ * the limit simply stay idle once the mixer is done with them.
+ */
+void limit_stream(AL_stream* stream, ALsizei active, ALsizei chunk)
+{
+    if (active < 2)
+        active = 2;
+    if (active > stream->depth)
+        active = stream->depth;
+    if (chunk < 1)
+        chunk = 1;
+    if (chunk > stream->frames)
+        chunk = stream->frames;
+    stream->active = active;
+    stream->chunk = chunk;
+    return;
+}
+
+/*
+ * Have refills converted to `out_format` (see convert.h) before upload.
+ * Call before the queue gets primed.
+ */
+ALboolean convert_stream(AL_stream* stream, ALenum out_format, ALuint flags)
+{
+    stream->out_format = out_format;
+    stream->flags = flags;
+    if (out_format == stream->format && flags == 0)
+        return AL_TRUE;
+    stream->converted = (ALubyte *)pcm_alloc(
+        stream->frames * format_frame_size(out_format));
+    if (stream->converted == NULL)
+    {
+        printf("Failed to allocate stream conversion memory.\n");
+        return AL_FALSE;
+    }
+    return AL_TRUE;
+}
+
+void unmap_stream(AL_stream* stream)
+{
+    register ALsizei i;
+
+    for (i = 0; i < stream->depth; i++)
+        if (stream->mapped[i] != NULL)
+            alUnmapBufferSOFT(stream->buffers[i]);
+    memset(stream->mapped, 0, sizeof(stream->mapped));
+    memset(stream->mapped_frames, 0, sizeof(stream->mapped_frames));
+    stream->map = AL_FALSE;
+    return;
+}
+
+/*
+ * Refill through persistent mappings of the buffers (AL_SOFT_map_buffer)
+ * instead of alBufferData.  Call after convert_stream() and before the
+ * first update; not with pull_stream().  Returns AL_FALSE, leaving the
+ * stream on alBufferData, without the extension or if mapping fails.
+ */
+ALboolean map_stream(AL_stream* stream)
+{
+    register ALsizei i;
+
+    if (have_cap(CAP_SOFT_MAP_BUFFER) == AL_FALSE)
+    {
+        printf("Failed to detect extension:  %s.\n", "AL_SOFT_map_buffer");
+        return AL_FALSE;
+    }
+    alBufferStorageSOFT = (LPALBUFFERSTORAGESOFT)
+        alGetProcAddress("alBufferStorageSOFT");
+    alMapBufferSOFT = (LPALMAPBUFFERSOFT)
+        alGetProcAddress("alMapBufferSOFT");
+    alUnmapBufferSOFT = (LPALUNMAPBUFFERSOFT)
+        alGetProcAddress("alUnmapBufferSOFT");
+    alFlushMappedBufferSOFT = (LPALFLUSHMAPPEDBUFFERSOFT)
+        alGetProcAddress("alFlushMappedBufferSOFT");
+    if (alBufferStorageSOFT == NULL || alMapBufferSOFT == NULL
+     || alUnmapBufferSOFT == NULL || alFlushMappedBufferSOFT == NULL)
+        return AL_FALSE;
+    alGetError();
+    for (i = 0; i < stream->depth; i++)
+        if (store_mapped(stream, i, stream->chunk, NULL) == AL_FALSE)
+        {
+            printf("Unable to map buffers of 0x%04X:  0x%04X\n",
+                stream->out_format, alGetError());
+            unmap_stream(stream);
+            return AL_FALSE;
+        }
+    stream->map = AL_TRUE;
+    return AL_TRUE;
+}
+
+LPALBUFFERCALLBACKSOFT alBufferCallbackSOFT;
+
+/*
+ * Runs on the mixer thread whenever it needs `size` more bytes.  Anything
+ * short of that would end the stream, so a dry producer gets padded with
+ * silence and counted as an underrun instead.
+ */
+ALsizei AL_APIENTRY stream_callback(ALvoid* user, ALvoid* data, ALsizei size)
+{
+    AL_stream* stream = (AL_stream *)user;
+    const ALsizei out_size = format_frame_size(stream->out_format);
+    ALubyte* out = (ALubyte *)data;
+    ALsizei frames = size / out_size;
+    const LONGLONG start = (stream->metrics != NULL) ? ticks_now() : 0;
+
+    while (frames > 0)
+    {
+        const ALvoid* in = stream->staging;
+        const ALsizei chunk = (frames < stream->frames)
+            ? frames : stream->frames;
+        ALsizei written;
+
+        if (stream->peek != NULL)
+            written = stream->peek(stream->user, &in, chunk);
+        else
+            written = stream->fill(stream->user, stream->staging, chunk);
+        if (written <= 0)
+            break;
+        if (stream->out_format == stream->format && stream->flags == 0)
+            memcpy(out, in, written * out_size);
+        else
+            convert_samples(out, stream->out_format, in, stream->format,
+                stream->flags, written);
+        out += written * out_size;
+        frames -= written;
+        ++stream->refills;
+    }
+    if (frames > 0)
+    {
+        const ALboolean unsigned8 = (stream->out_format == AL_FORMAT_MONO8
+                                  || stream->out_format == AL_FORMAT_STEREO8);
+
+        memset(out, unsigned8 ? 0x80 : 0x00, frames * out_size);
+        ++stream->underruns;
+    }
+    if (stream->metrics != NULL)
+        record_histogram(&stream->metrics->pull,
+            ticks_to_us(ticks_now() - start));
+    return (size);
+}
+
+/*
+ * Have the mixer pull samples through AL_SOFT_callback_buffer, bypassing
+ * the queue.  Call after convert_stream() and before the first update.
+ * Returns AL_FALSE, leaving the stream queued, without the extension.
+ */
+ALboolean pull_stream(AL_stream* stream)
+{
+    if (have_cap(CAP_SOFT_CALLBACK_BUFFER) == AL_FALSE)
+    {
+        printf("Failed to detect extension:  %s.\n",
+            "AL_SOFT_callback_buffer");
+        return AL_FALSE;
+    }
+    alBufferCallbackSOFT = (LPALBUFFERCALLBACKSOFT)
+        alGetProcAddress("alBufferCallbackSOFT");
+    if (alBufferCallbackSOFT == NULL)
+        return AL_FALSE;
+    alGetError();
+    alBufferCallbackSOFT(stream->buffers[0], stream->out_format,
+        stream->frequency, stream_callback, stream);
+    alSourcei(stream->source, AL_BUFFER, stream->buffers[0]);
+    if (alGetError() != AL_NO_ERROR)
+    {
+        printf("Unable to set up a callback buffer for 0x%04X.\n",
+            stream->out_format);
+        alSourcei(stream->source, AL_BUFFER, AL_NONE);
+        return AL_FALSE;
+    }
+    stream->pull = AL_TRUE;
+    stream->idle_count = 0; /* No queue to prime. */
+    return AL_TRUE;
+}
+
+/*
+ * Sample frames handed to AL but not yet played:  the unplayed part of the
+ * queue in push mode, nothing beyond the mixer's own period in pull mode.
+ */
+ALsizei stream_latency_frames(const AL_stream* stream)
+{
+    ALint queued, offset;
+
+    if (stream->pull)
+        return 0;
+    alGetSourcei(stream->source, AL_BUFFERS_QUEUED, &queued);
+    alGetSourcei(stream->source, AL_SAMPLE_OFFSET, &offset);
+    return (queued * stream->chunk - offset);
+}
+
+/*
+ * Recycle every processed buffer back into the queue.
+ * Call this more often than once per buffer duration, or the queue drains.
+ *
+ * Returns the count of buffers refilled.
+ */
+ALint update_stream(AL_stream* stream)
+{
+    ALint processed, queued, state;
+    ALuint buf;
+    ALint refilled;
+    const LONGLONG start = (stream->metrics != NULL) ? ticks_now() : 0;
+
+    refilled = 0;
+    alGetSourcei(stream->source, AL_BUFFERS_PROCESSED, &processed);
+    if (stream->metrics != NULL && !stream->pull)
+        record_low_water(stream->metrics,
+            stream->depth - stream->idle_count - processed);
+    while (processed-- > 0)
+    {
+        alSourceUnqueueBuffers(stream->source, 1, &buf);
+        stream->idle[stream->idle_count++] = buf;
+    }
+    while (stream->idle_count > stream->depth - stream->active)
+    {
+        ALsizei written;
+
+        buf = stream->idle[stream->idle_count - 1];
+        written = refill_buffer(stream, buf);
+        if (written == 0)
+            break; /* producer is dry; try these again next update */
+        alSourceQueueBuffers(stream->source, 1, &buf);
+        --stream->idle_count;
+        ++refilled;
+        if (written < stream->chunk && stream->peek == NULL)
+            break; /* no point asking again so soon */
+    }
+
+/*
+ * If the source ran through every queued buffer before we got here, OpenAL
+ * stopped it.  Resume playback if nobody asked for a stop or a pause.
+ * `playing` is checked last, as another thread may clear it before calling
+ * alSourceStop or alSourcePause.
+ */
+    alGetSourcei(stream->source, AL_SOURCE_STATE, &state);
+    alGetSourcei(stream->source, AL_BUFFERS_QUEUED, &queued);
+    if (state == AL_STOPPED && queued > 0 && stream->playing)
+    {
+        ++stream->underruns;
+        alSourcePlay(stream->source);
+    }
+    if (stream->metrics != NULL)
+        record_histogram(&stream->metrics->update,
+            ticks_to_us(ticks_now() - start));
+    return (refilled);
+}
+
+void close_stream(AL_stream* stream)
+{
+    alSourceStop(stream->source);
+    alSourcei(stream->source, AL_BUFFER, AL_NONE); /* unqueues everything */
+    unmap_stream(stream); /* Mapped buffers cannot be deleted. */
+    alDeleteBuffers(stream->depth, stream->buffers);
+    pcm_free(stream->staging);
+    pcm_free(stream->converted);
+    stream->staging = NULL;
+    stream->converted = NULL;
+    stream->depth = 0;
+    return;
+}
+
+/*
+ * Trivial producer:  replays one sound held in memory over and over, the
+ * streamed equivalent of AL_LOOPING on the static buffer.
+ */
+typedef struct {
+    const ALubyte* data;
+    ALsizei size; /* in bytes, whole frames only */
+    ALsizei cursor;
+    ALsizei frame_size;
+} memory_loop;
+
+ALsizei fill_memory_loop(ALvoid* user, ALvoid* data, ALsizei frames)
+{
+    memory_loop* loop = (memory_loop *)user;
+    ALubyte* out = (ALubyte *)data;
+    ALsizei bytes = frames * loop->frame_size;
+
+    if (loop->size <= 0)
+        return 0;
+    while (bytes > 0)
+    {
+        ALsizei count = loop->size - loop->cursor;
+
+        if (count > bytes)
+            count = bytes;
+        memcpy(out, loop->data + loop->cursor, count);
+        out += count;
+        bytes -= count;
+        loop->cursor += count;
+        if (loop->cursor >= loop->size)
+            loop->cursor = 0;
+    }
+    return (frames);
+}
+
+/*
+ * Zero-copy flavour of the above:  hands out the held sound in place, up to
+ * its end, then wraps around on the next call.
+ */
+ALsizei peek_memory_loop(ALvoid* user, const ALvoid** data, ALsizei frames)
+{
+    memory_loop* loop = (memory_loop *)user;
+    ALsizei count = loop->size - loop->cursor;
+
+    if (loop->size <= 0)
+        return 0;
+    if (count > frames * loop->frame_size)
+        count = frames * loop->frame_size;
+    *data = loop->data + loop->cursor;
+    loop->cursor += count;
+    if (loop->cursor >= loop->size)
+        loop->cursor = 0;
+    return (count / loop->frame_size);
+}
@@ -0,0 +1,286 @@
+/*
+ * State-transition stress test:  millions of random alSourcePlay, Pause,
+ * Stop and Rewind calls, timed until AL_SOURCE_STATE shows the result.
+ *
+ * Every worker thread owns STRESS_SOURCES sources of one shared loopback
+ * context, bound with alcSetThreadContext() (ALC_EXT_thread_local_context),
+ * all looping the test tone, while another thread keeps the mixer
+ * rendering the whole time, as a game retriggering sound effects would see
+ * it.  Since the buffers loop, a source can only change state when told to,
+ * so every transition must end in the state the OpenAL 1.1 state machine
+ * gives (the one main() prints for each key):
+ *
+ *     Play:    any state to AL_PLAYING (AL_PAUSED resumes)
+ *     Pause:   AL_PLAYING to AL_PAUSED, else no change
+ *     Stop:    AL_PLAYING or AL_PAUSED to AL_STOPPED, else no change
+ *     Rewind:  any state to AL_INITIAL
+ *
+ * The latency of one transition runs from the call until the state is first
+ * read back as expected, in nanoseconds, binned per key into histograms
+ * (metrics.h) for p50 and p99.  One taking over STRESS_STALL is a stall;
+ * one not showing after STRESS_TIMEOUT is a violation, and the state read
+ * back then becomes the one the worker goes on from.
+ */
+#define STRESS_THREADS  32
+#define STRESS_SOURCES  16 /* sources per worker thread */
+#define STRESS_TOTAL    4000000 /* transitions across all workers */
+#define STRESS_STALL    1000000 /* nanoseconds */
+#define STRESS_TIMEOUT  0.1 /* seconds */
+
+const char stress_keys[4] = { 'P', 'H', 'S', 'R' };
+
+typedef struct {
+    histogram latency[4]; /* per key in stress_keys, in nanoseconds */
+    volatile LONG stalls[4];
+    volatile LONG violations[4];
+} stress_totals;
+
+typedef struct {
+    ALuint sources[STRESS_SOURCES];
+    ALint states[STRESS_SOURCES]; /* as last seen */
+    ALsizei transitions;
+    ALuint seed;
+    ALCcontext* context;
+    stress_totals* totals;
+    HANDLE thread;
+} stress_worker;
+
+typedef struct {
+    ALCdevice* device;
+    volatile LONG done;
+    ALsizei frames;
+} stress_mixer;
+
+/*
+ * where the OpenAL 1.1 state machine takes `state` on key `k`
+ */
+ALint next_source_state(ALint state, int k)
+{
+    switch (k)
+    {
+    case 'P':
+        return AL_PLAYING;
+    case 'H':
+        return (state == AL_PLAYING) ? AL_PAUSED : state;
+    case 'S':
+        return (state == AL_PLAYING || state == AL_PAUSED)
+            ? AL_STOPPED : state;
+    case 'R':
+        return AL_INITIAL;
+    }
+    return (state);
+}
+
+ALuint stress_random(ALuint* seed)
+{
+    ALuint x = *seed; /* xorshift32 */
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return (x);
+}
+
+/*
+ * Time key `stress_keys[k]` on `w->sources[i]`, from the call until the
+ * state it leads to is observed.
+ */
+void stress_transition(stress_worker* w, ALsizei i, int k)
+{
+    const ALuint src = w->sources[i];
+    const ALint expected = next_source_state(w->states[i], stress_keys[k]);
+    ALdouble start, now;
+    ALint state = AL_NONE; /* should alGetSourcei() fail */
+    LONG nanoseconds;
+
+    start = seconds_now();
+    switch (stress_keys[k])
+    {
+    case 'P':  alSourcePlay(src);    break;
+    case 'H':  alSourcePause(src);   break;
+    case 'S':  alSourceStop(src);    break;
+    case 'R':  alSourceRewind(src);  break;
+    }
+    do {
+        alGetSourcei(src, AL_SOURCE_STATE, &state);
+        now = seconds_now();
+    } while (state != expected && now - start < STRESS_TIMEOUT);
+
+    nanoseconds = (LONG)((now - start) * 1e9);
+    if (state != expected)
+    {
+        if (InterlockedIncrement(&w->totals->violations[k]) <= 4)
+            printf("Source %u:  %c from %s left %s, not %s\n", src,
+                stress_keys[k],
+                AL_source_states[(w->states[i] - AL_INITIAL) & 3],
+                AL_source_states[(state - AL_INITIAL) & 3],
+                AL_source_states[(expected - AL_INITIAL) & 3]);
+        w->states[i] = state;
+        return;
+    }
+    w->states[i] = state;
+    record_histogram(&w->totals->latency[k], nanoseconds);
+    if (nanoseconds > STRESS_STALL)
+        InterlockedIncrement(&w->totals->stalls[k]);
+    return;
+}
+
+DWORD WINAPI stress_worker_main(LPVOID param)
+{
+    stress_worker* w = (stress_worker *)param;
+    register ALsizei n;
+
+    bind_context(w->context);
+    for (n = 0; n < w->transitions; n++)
+    {
+        const ALuint r = stress_random(&w->seed);
+
+        stress_transition(w, (ALsizei)(r % STRESS_SOURCES), (int)(r >> 30));
+    }
+    alSourceStopv(STRESS_SOURCES, w->sources);
+    bind_context(NULL);
+    return 0;
+}
+
+DWORD WINAPI stress_mixer_main(LPVOID param)
+{
+    stress_mixer* m = (stress_mixer *)param;
+    ALshort output[2 * SESSION_UPDATE];
+
+    while (m->done == 0)
+    {
+        alcRenderSamplesSOFT(m->device, output, SESSION_UPDATE);
+        m->frames += SESSION_UPDATE;
+    }
+    return 0;
+}
+
+void log_stress_totals(const stress_totals* totals, ALdouble seconds)
+{
+    static const histogram none;
+    LONG count = 0, violations = 0;
+    register int k, i;
+
+    printf("%4s %10s %10s %10s %10s %8s %10s\n", "key", "calls",
+        "p50 (ns)", "p99 (ns)", "max (ns)", "stalls", "violations");
+    for (k = 0; k < 4; k++)
+    {
+        const histogram* h = &totals->latency[k];
+        LONG calls = 0;
+
+        for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+            calls += h->count[i];
+        calls += totals->violations[k];
+        count += calls;
+        violations += totals->violations[k];
+        printf("%4c %10li %10li %10li %10li %8li %10li\n", stress_keys[k],
+            (long)calls, (long)histogram_percentile(h, &none, 50),
+            (long)histogram_percentile(h, &none, 99), (long)h->max,
+            (long)totals->stalls[k], (long)totals->violations[k]);
+    }
+    printf("%li transitions in %.2f s (%.0f/s), %li off the state machine\n",
+        (long)count, seconds, count / seconds, (long)violations);
+    return;
+}
+
+/*
+ * Returns 0 if every transition ended where the state machine said.
+ */
+int run_state_stress(ALsizei threads)
+{
+    static stress_worker workers[STRESS_THREADS];
+    static stress_totals totals;
+    stress_mixer mixer;
+    HANDLE mixing, handles[STRESS_THREADS];
+    ALCcontext* context;
+    ALuint tone;
+    ALdouble start, seconds;
+    register ALsizei i, j;
+
+    if (threads < 1 || threads > STRESS_THREADS)
+    {
+        printf("Run 1 to %i stress threads.\n", STRESS_THREADS);
+        return 1;
+    }
+    if (load_loopback_functions() == AL_FALSE)
+        return 1;
+    if (alcSetThreadContext == NULL)
+    { /* Else one worker unbinding on its way out would unbind them all. */
+        printf("Failed to detect extension:  %s.\n",
+            "ALC_EXT_thread_local_context");
+        return 1;
+    }
+    context = open_loopback_context(&mixer.device, BENCH_RATE,
+        threads * STRESS_SOURCES);
+    if (context == NULL)
+        return 1;
+    memset(&totals, 0, sizeof(stress_totals));
+    initialize_listener();
+    alGenBuffers(1, &tone);
+    if (upload_test_tone(tone, AL_FORMAT_MONO16, BENCH_TONE) == AL_FALSE)
+    {
+        close_loopback_context(mixer.device, context);
+        return 1;
+    }
+    for (i = 0; i < threads; i++)
+    {
+        stress_worker* w = &workers[i];
+
+        alGenSources(STRESS_SOURCES, w->sources);
+        for (j = 0; j < STRESS_SOURCES; j++)
+        {
+            setup_source(w->sources[j]);
+            alSourcei(w->sources[j], AL_BUFFER, tone);
+            alSourcei(w->sources[j], AL_LOOPING, AL_TRUE);
+            w->states[j] = AL_INITIAL;
+        }
+        w->transitions = STRESS_TOTAL / threads;
+        w->seed = 2463534242U + 977 * i; /* never 0 */
+        w->context = context;
+        w->totals = &totals;
+    }
+    if (alGetError() != AL_NO_ERROR)
+    {
+        printf("Unable to set up %i stress sources.\n",
+            threads * STRESS_SOURCES);
+        close_loopback_context(mixer.device, context);
+        return 1;
+    }
+
+    mixer.done = 0;
+    mixer.frames = 0;
+    mixing = CreateThread(NULL, 0, stress_mixer_main, &mixer, 0, NULL);
+    start = seconds_now();
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].thread = CreateThread(NULL, 0, stress_worker_main,
+            &workers[i], 0, NULL);
+        if (workers[i].thread == NULL)
+            break;
+        handles[i] = workers[i].thread;
+    }
+    if (i > 0)
+        WaitForMultipleObjects(i, handles, TRUE, INFINITE);
+    seconds = seconds_now() - start;
+    InterlockedExchange(&mixer.done, 1);
+    if (mixing != NULL)
+    {
+        WaitForSingleObject(mixing, INFINITE);
+        CloseHandle(mixing);
+    }
+    for (j = 0; j < i; j++)
+        CloseHandle(handles[j]);
+
+    printf("%i threads on %i sources, %i frames mixed meanwhile\n", i,
+        threads * STRESS_SOURCES, mixer.frames);
+    log_stress_totals(&totals, seconds);
+    for (j = 0; j < threads; j++)
+        alDeleteSources(STRESS_SOURCES, workers[j].sources);
+    alDeleteBuffers(1, &tone);
+    close_loopback_context(mixer.device, context);
+    for (j = 0; j < 4; j++)
+        if (totals.violations[j] != 0)
+            return 1;
+    return (i == threads) ? 0 : 1;
+}
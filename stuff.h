@@ -6,6 +6,12 @@ ALuint source;
 
 #define BUFFER_SIZE     4410
 
+ALboolean initialize_listener(void);
+ALboolean setup_source(ALuint src);
+ALboolean initialize_source(void);
+void begin_updates(void);
+void end_updates(void);
+
 const char* AL_source_states[4] = {
     "AL_INITIAL",
     "AL_PLAYING",
@@ -26,14 +32,6 @@ ALCdevice* init_AL_device(void)
  * Therefore, we need to guarantee this is zeroed to begin with.
  */
     alGetError();
-#if (0)
-    success = alutInit(NULL, 0);
-    if (success == AL_FALSE)
-    {
-        printf("Failed to init ALUT.\n");
-        return NULL;
-    }
-#endif
     device = alcOpenDevice(NULL); /* open default device */
     if (device == NULL) /* Plug in some headphones or something! */
         printf("Unable to detect a sound device.\n");
@@ -48,9 +46,6 @@ ALCboolean finish_AL_context(void)
 
     alDeleteSources(NUM_SOURCES, &source); /* can be deleted any time */
     alDeleteBuffers(NUM_BUFFERS, &buffer); /* cannot delete if attached */
-#if (0)
-    alutExit(); /* to-do:  Do we really need ALUT? */
-#endif
     context = alcGetCurrentContext();
     device = alcGetContextsDevice(context);
     success  = alcMakeContextCurrent(NULL);
@@ -59,23 +54,6 @@ ALCboolean finish_AL_context(void)
     return (success);
 }
 
-void change_volume(ALfloat gain)
-{
-/*
- * Experimental volume changer.
- * OpenAL 1.1 specifications standardize the range 0.0 <= gain <= 1.0.
- * 0.0 is the way to mute and possibly even disable sound processing latency.
- * 1.0 could be the maximum volume ratio.  Some implementations allow higher.
- */
-#if (0)
-    alSourcef(source, AL_MIN_GAIN, 0.0F); /* can't have negative gains anyway */
-    alSourcef(source, AL_MAX_GAIN, gain); /* uncertain ... allow gains > 1.0? */
-#endif
-    alListenerf(AL_GAIN, gain);
-    alSourcef(source, AL_GAIN, gain); /* Pretty much overruled by alListener. */
-    return;
-}
-
 void DEBUG_SOURCE_STATE(ALint query)
 {
 /*
@@ -231,24 +209,46 @@ void log_AL_device_states(ALCdevice* device)
     return;
 }
 
-void log_buffer_attributes(void)
+void log_buffer_attributes(ALuint buf)
 {
     FILE *out;
-    ALint query;
+    ALint query, size;
 
     out = fopen("BUFFERAT.TXT", "w");
-    alGetBufferi(buffer, AL_FREQUENCY, &query);
+    alGetBufferi(buf, AL_FREQUENCY, &query);
     fprintf(out, "Period  :  %i samples per second\n", query); /* "Hertz" */
-    alGetBufferi(buffer, AL_SIZE, &query);
-    fprintf(out, "Raw size:  %i bytes\n", query);
-    alGetBufferi(buffer, AL_BITS, &query); /* either 8 or 16 b/sample */
+    alGetBufferi(buf, AL_SIZE, &size);
+    fprintf(out, "Raw size:  %i bytes\n", size);
+    alGetBufferi(buf, AL_BITS, &query); /* 8 or 16, or 4 for ADPCM */
     fprintf(out, "Samples :  %i bits each\n", query);
-    alGetBufferi(buffer, AL_CHANNELS, &query); /* either stereo or mono */
+    if (query > 0 && query < 16)
+        fprintf(out, "As PCM16:  %i bytes\n", size / query * 16);
+    alGetBufferi(buf, AL_CHANNELS, &query); /* either stereo or mono */
     fprintf(out, "Channels:  %i\n", query);
     fclose(out);
     return;
 }
 
+/*
+ * X-RAM as found by probe_EAX_RAM(), for code placing buffers of its own.
+ * The storage mode of a buffer must be set before its first alBufferData.
+ */
+EAXSetBufferMode eaxSetBufferMode = NULL;
+ALenum XRAM_hardware, XRAM_accessible;
+ALint XRAM_free = 0; /* in bytes, at the time of the probe */
+
+ALboolean probe_EAX_RAM(void)
+{
+    if (have_cap(CAP_EAX_RAM) == AL_FALSE)
+        return AL_FALSE;
+    XRAM_hardware = alGetEnumValue("AL_STORAGE_HARDWARE");
+    XRAM_accessible = alGetEnumValue("AL_STORAGE_ACCESSIBLE");
+    XRAM_free = alGetInteger(alGetEnumValue("AL_EAX_RAM_FREE"));
+    eaxSetBufferMode = (EAXSetBufferMode)
+        alGetProcAddress("EAXSetBufferMode");
+    return (eaxSetBufferMode != NULL);
+}
+
 void setup_EAX_RAM(void)
 {
     EAXSetBufferMode g_eaxSetMode;
@@ -256,7 +256,7 @@ void setup_EAX_RAM(void)
     ALint iRAMSizeMB, iRAMFreeMB;
     ALenum g_eXRAMSize, g_eXRAMFree;
     ALenum g_eXRAMAuto, g_eXRAMHardware, g_eXRAMAccessible;
-    const ALboolean have_XRAM = alIsExtensionPresent("EAX-RAM");
+    const ALboolean have_XRAM = have_cap(CAP_EAX_RAM);
 
     if (have_XRAM == AL_FALSE)
         return;
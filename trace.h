@@ -0,0 +1,563 @@
+/*
+ * AL call tracing, for debug builds only.
+ *
+ * Unless NDEBUG is defined, the AL and ALC entry points listed at the end
+ * (the source, listener and buffer calls, device and context management,
+ * and the loopback, thread-context and buffer-callback extensions) are
+ * redefined below as macros calling traced_*() wrappers.  Each wrapper
+ * makes the real call, then records its name, arguments, duration and
+ * resulting error into a ring of the last TRACE_ENTRIES calls belonging to
+ * the calling thread.  dump_AL_trace() writes every thread's ring out.
+ * Threads past the first TRACE_THREADS go untraced.
+ *
+ * The wrappers have to call alGetError() to see each call's error, which
+ * would swallow it before the code that made the call got to check.  AL
+ * keeps one error per context, whichever thread caused it, so the first
+ * error seen is held for the current context (for the first TRACE_CONTEXTS
+ * of them), and alGetError() is redefined to hand that back first, as AL
+ * itself would.
+ *
+ * With NDEBUG, none of this exists and every call is the bare AL call.
+ */
+#ifdef _MSC_VER
+#define THREAD_LOCAL    __declspec(thread)
+#else
+#define THREAD_LOCAL    __thread
+#endif
+
+LONGLONG ticks_now(void)
+{
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+    return (now.QuadPart);
+}
+
+LONG ticks_to_us(LONGLONG ticks)
+{
+    static LARGE_INTEGER frequency;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    return (LONG)(ticks * 1000000 / frequency.QuadPart);
+}
+
+ALdouble ticks_to_seconds(LONGLONG ticks)
+{
+    static LARGE_INTEGER frequency;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    return (ALdouble)ticks / (ALdouble)frequency.QuadPart;
+}
+
+/*
+ * AL error codes start at 0xA001, so they cannot index a table directly.
+ */
+const char* AL_error_string(ALenum error)
+{
+    switch (error)
+    {
+    case AL_NO_ERROR:           return "AL_NO_ERROR";
+    case AL_INVALID_NAME:       return "AL_INVALID_NAME";
+    case AL_INVALID_ENUM:       return "AL_INVALID_ENUM";
+    case AL_INVALID_VALUE:      return "AL_INVALID_VALUE";
+    case AL_INVALID_OPERATION:  return "AL_INVALID_OPERATION";
+    case AL_OUT_OF_MEMORY:      return "AL_OUT_OF_MEMORY";
+    }
+    return "(unknown AL error)";
+}
+
+const char* ALC_error_string(ALCenum error)
+{
+    switch (error)
+    {
+    case ALC_NO_ERROR:          return "ALC_NO_ERROR";
+    case ALC_INVALID_DEVICE:    return "ALC_INVALID_DEVICE";
+    case ALC_INVALID_CONTEXT:   return "ALC_INVALID_CONTEXT";
+    case ALC_INVALID_ENUM:      return "ALC_INVALID_ENUM";
+    case ALC_INVALID_VALUE:     return "ALC_INVALID_VALUE";
+    case ALC_OUT_OF_MEMORY:     return "ALC_OUT_OF_MEMORY";
+    }
+    return "(unknown ALC error)";
+}
+
+#ifndef NDEBUG
+#define TRACE_ENTRIES   256 /* power of two */
+#define TRACE_THREADS   16
+#define TRACE_CONTEXTS  16
+
+typedef struct {
+    const char* name;
+    ALdouble args[4];
+    LONGLONG start;
+    LONGLONG ticks; /* duration */
+    ALenum error;
+    ALboolean ALC; /* `error` is an ALCenum */
+} trace_entry;
+
+typedef struct {
+    DWORD thread_id;
+    ALuint head; /* entries ever recorded */
+    trace_entry entries[TRACE_ENTRIES];
+} trace_ring;
+
+/*
+ * Rings are allocated on first use and never freed, so they can still be
+ * dumped after their threads have exited.
+ */
+trace_ring* trace_rings[TRACE_THREADS];
+volatile LONG trace_ring_count = 0;
+LONGLONG trace_epoch; /* when the first ring was set up */
+THREAD_LOCAL trace_ring* local_trace;
+trace_ring untraced; /* the local_trace of threads left out */
+
+/*
+ * The error each context had when a wrapper took it from AL
+ */
+typedef struct {
+    ALCcontext* volatile context;
+    volatile LONG error;
+} pending_error;
+
+pending_error pending_errors[TRACE_CONTEXTS];
+
+/*
+ * Returns NULL with no context current, or too many contexts about.
+ */
+volatile LONG* context_error(void)
+{
+    ALCcontext* const context = (alcGetCurrentContext)();
+    register int i;
+
+    if (context == NULL)
+        return NULL;
+    for (i = 0; i < TRACE_CONTEXTS; i++)
+    {
+        ALCcontext* owner = pending_errors[i].context;
+
+        if (owner == NULL)
+        { /* Claim the slot, unless another thread just did. */
+            owner = (ALCcontext *)InterlockedCompareExchangePointer(
+                (PVOID volatile *)&pending_errors[i].context, context, NULL);
+            if (owner == NULL)
+                owner = context;
+        }
+        if (owner == context)
+            return &pending_errors[i].error;
+    }
+    return NULL;
+}
+
+trace_entry* next_trace_entry(void)
+{
+    trace_ring* ring = local_trace;
+
+    if (ring == &untraced)
+        return NULL;
+    if (ring == NULL)
+    {
+        const LONG slot = (trace_ring_count < TRACE_THREADS)
+            ? InterlockedIncrement(&trace_ring_count) - 1 : TRACE_THREADS;
+
+        if (slot < TRACE_THREADS)
+            ring = (trace_ring *)calloc(1, sizeof(trace_ring));
+        if (ring == NULL)
+        { /* too many threads to trace, or no memory:  leave this one out */
+            local_trace = &untraced;
+            return NULL;
+        }
+        ring->thread_id = GetCurrentThreadId();
+        if (slot == 0)
+            trace_epoch = ticks_now();
+        trace_rings[slot] = ring;
+        local_trace = ring;
+    }
+    return &ring->entries[ring->head++ & (TRACE_ENTRIES - 1)];
+}
+
+void trace_call(const char* name, LONGLONG start, ALenum error,
+    ALboolean ALC, ALdouble a0, ALdouble a1, ALdouble a2, ALdouble a3)
+{
+    const LONGLONG end = ticks_now();
+    trace_entry* entry = next_trace_entry();
+
+    if (entry == NULL)
+        return;
+    entry->name = name;
+    entry->args[0] = a0;
+    entry->args[1] = a1;
+    entry->args[2] = a2;
+    entry->args[3] = a3;
+    entry->start = start;
+    entry->ticks = end - start;
+    entry->error = error;
+    entry->ALC = ALC;
+    return;
+}
+
+/*
+ * Take the error of the call just made from AL, keeping it for the context
+ * if none is held yet.
+ */
+ALenum AL_call_error(void)
+{
+    const ALenum error = (alGetError)();
+    volatile LONG* held;
+
+    if (error == AL_NO_ERROR)
+        return (error);
+    held = context_error();
+    if (held != NULL)
+        InterlockedCompareExchange(held, error, AL_NO_ERROR);
+    return (error);
+}
+
+void trace_AL(const char* name, LONGLONG start,
+    ALdouble a0, ALdouble a1, ALdouble a2, ALdouble a3)
+{
+    trace_call(name, start, AL_call_error(), AL_FALSE, a0, a1, a2, a3);
+    return;
+}
+
+ALenum traced_alGetError(void)
+{
+    const ALenum now = (alGetError)(); /* cleared either way */
+    volatile LONG* held = context_error();
+    const ALenum error = (held != NULL)
+        ? (ALenum)InterlockedExchange(held, AL_NO_ERROR) : AL_NO_ERROR;
+
+    return (error != AL_NO_ERROR) ? error : now;
+}
+
+/*
+ * the first of `n` names, which are only read if there are any
+ */
+ALdouble first_name(ALsizei n, const ALuint* names)
+{
+    return (n > 0) ? names[0] : 0;
+}
+
+/*
+ * One wrapper per traced entry point.  Pointer arguments are recorded by
+ * their first element, or by their size for sample data; what AL writes
+ * back is only recorded if the call succeeded.
+ */
+#define TRACE_START     const LONGLONG start = ticks_now()
+
+void traced_alSourcef(ALuint src, ALenum param, ALfloat value)
+{
+    TRACE_START;
+    (alSourcef)(src, param, value);
+    trace_AL("alSourcef", start, src, param, value, 0);
+}
+void traced_alSourcei(ALuint src, ALenum param, ALint value)
+{
+    TRACE_START;
+    (alSourcei)(src, param, value);
+    trace_AL("alSourcei", start, src, param, value, 0);
+}
+void traced_alSource3f(ALuint src, ALenum param, ALfloat x, ALfloat y,
+    ALfloat z)
+{
+    TRACE_START;
+    (alSource3f)(src, param, x, y, z);
+    trace_AL("alSource3f", start, src, param, x, y);
+}
+void traced_alSourcefv(ALuint src, ALenum param, const ALfloat* values)
+{
+    TRACE_START;
+    (alSourcefv)(src, param, values);
+    trace_AL("alSourcefv", start, src, param, values[0], 0);
+}
+void traced_alGetSourcei(ALuint src, ALenum param, ALint* value)
+{
+    TRACE_START;
+    ALenum error;
+
+    (alGetSourcei)(src, param, value);
+    error = AL_call_error();
+    trace_call("alGetSourcei", start, error, AL_FALSE, src, param,
+        (error == AL_NO_ERROR) ? *value : 0, 0);
+}
+void traced_alListenerf(ALenum param, ALfloat value)
+{
+    TRACE_START;
+    (alListenerf)(param, value);
+    trace_AL("alListenerf", start, param, value, 0, 0);
+}
+void traced_alListener3f(ALenum param, ALfloat x, ALfloat y, ALfloat z)
+{
+    TRACE_START;
+    (alListener3f)(param, x, y, z);
+    trace_AL("alListener3f", start, param, x, y, z);
+}
+void traced_alListenerfv(ALenum param, const ALfloat* values)
+{
+    TRACE_START;
+    (alListenerfv)(param, values);
+    trace_AL("alListenerfv", start, param, values[0], 0, 0);
+}
+void traced_alSourcePlay(ALuint src)
+{
+    TRACE_START;
+    (alSourcePlay)(src);
+    trace_AL("alSourcePlay", start, src, 0, 0, 0);
+}
+void traced_alSourceStop(ALuint src)
+{
+    TRACE_START;
+    (alSourceStop)(src);
+    trace_AL("alSourceStop", start, src, 0, 0, 0);
+}
+void traced_alSourcePause(ALuint src)
+{
+    TRACE_START;
+    (alSourcePause)(src);
+    trace_AL("alSourcePause", start, src, 0, 0, 0);
+}
+void traced_alSourceRewind(ALuint src)
+{
+    TRACE_START;
+    (alSourceRewind)(src);
+    trace_AL("alSourceRewind", start, src, 0, 0, 0);
+}
+void traced_alSourcePlayv(ALsizei n, const ALuint* sources)
+{
+    TRACE_START;
+    (alSourcePlayv)(n, sources);
+    trace_AL("alSourcePlayv", start, n, first_name(n, sources), 0, 0);
+}
+void traced_alSourceStopv(ALsizei n, const ALuint* sources)
+{
+    TRACE_START;
+    (alSourceStopv)(n, sources);
+    trace_AL("alSourceStopv", start, n, first_name(n, sources), 0, 0);
+}
+void traced_alSourceQueueBuffers(ALuint src, ALsizei n, const ALuint* bufs)
+{
+    TRACE_START;
+    (alSourceQueueBuffers)(src, n, bufs);
+    trace_AL("alSourceQueueBuffers", start, src, n, first_name(n, bufs),
+        0);
+}
+void traced_alSourceUnqueueBuffers(ALuint src, ALsizei n, ALuint* bufs)
+{
+    TRACE_START;
+    ALenum error;
+
+    (alSourceUnqueueBuffers)(src, n, bufs);
+    error = AL_call_error();
+    trace_call("alSourceUnqueueBuffers", start, error, AL_FALSE, src, n,
+        (error == AL_NO_ERROR) ? first_name(n, bufs) : 0, 0);
+}
+void traced_alBufferData(ALuint buf, ALenum format, const ALvoid* data,
+    ALsizei size, ALsizei frequency)
+{
+    TRACE_START;
+    (alBufferData)(buf, format, data, size, frequency);
+    trace_AL("alBufferData", start, buf, format, size, frequency);
+}
+void traced_alBufferi(ALuint buf, ALenum param, ALint value)
+{
+    TRACE_START;
+    (alBufferi)(buf, param, value);
+    trace_AL("alBufferi", start, buf, param, value, 0);
+}
+void traced_alGenBuffers(ALsizei n, ALuint* bufs)
+{
+    TRACE_START;
+    ALenum error;
+
+    (alGenBuffers)(n, bufs);
+    error = AL_call_error();
+    trace_call("alGenBuffers", start, error, AL_FALSE, n,
+        (error == AL_NO_ERROR) ? first_name(n, bufs) : 0, 0, 0);
+}
+void traced_alDeleteBuffers(ALsizei n, const ALuint* bufs)
+{
+    TRACE_START;
+    (alDeleteBuffers)(n, bufs);
+    trace_AL("alDeleteBuffers", start, n, first_name(n, bufs), 0, 0);
+}
+void traced_alGenSources(ALsizei n, ALuint* sources)
+{
+    TRACE_START;
+    ALenum error;
+
+    (alGenSources)(n, sources);
+    error = AL_call_error();
+    trace_call("alGenSources", start, error, AL_FALSE, n,
+        (error == AL_NO_ERROR) ? first_name(n, sources) : 0, 0, 0);
+}
+void traced_alDeleteSources(ALsizei n, const ALuint* sources)
+{
+    TRACE_START;
+    (alDeleteSources)(n, sources);
+    trace_AL("alDeleteSources", start, n, first_name(n, sources), 0, 0);
+}
+
+/*
+ * Extension entry points, defined where they are loaded (bench.h and
+ * stream.h), NULL until then.
+ */
+extern LPALBUFFERCALLBACKSOFT alBufferCallbackSOFT;
+extern LPALCRENDERSAMPLESSOFT alcRenderSamplesSOFT;
+extern PFNALCSETTHREADCONTEXTPROC alcSetThreadContext;
+
+void traced_alBufferCallbackSOFT(ALuint buf, ALenum format,
+    ALsizei frequency, ALBUFFERCALLBACKTYPESOFT callback, ALvoid* user)
+{
+    TRACE_START;
+    (alBufferCallbackSOFT)(buf, format, frequency, callback, user);
+    trace_AL("alBufferCallbackSOFT", start, buf, format, frequency, 0);
+}
+
+/*
+ * ALC errors belong to the device.  Nothing else here asks alcGetError(),
+ * so the tracer may take them as they come.
+ */
+ALCdevice* traced_alcOpenDevice(const ALCchar* name)
+{
+    TRACE_START;
+    ALCdevice* device = (alcOpenDevice)(name);
+
+    trace_call("alcOpenDevice", start,
+        (device == NULL) ? ALC_INVALID_VALUE : ALC_NO_ERROR, AL_TRUE,
+        (name != NULL), 0, 0, 0);
+    return (device);
+}
+ALCboolean traced_alcCloseDevice(ALCdevice* device)
+{
+    TRACE_START;
+    const ALCboolean closed = (alcCloseDevice)(device);
+
+    trace_call("alcCloseDevice", start,
+        closed ? ALC_NO_ERROR : ALC_INVALID_DEVICE, AL_TRUE, 0, 0, 0, 0);
+    return (closed);
+}
+ALCcontext* traced_alcCreateContext(ALCdevice* device, const ALCint* attrs)
+{
+    TRACE_START;
+    ALCcontext* context = (alcCreateContext)(device, attrs);
+
+    trace_call("alcCreateContext", start, alcGetError(device), AL_TRUE,
+        (attrs != NULL) ? attrs[0] : 0, (attrs != NULL) ? attrs[1] : 0, 0, 0);
+    return (context);
+}
+ALCboolean traced_alcMakeContextCurrent(ALCcontext* context)
+{
+    TRACE_START;
+    const ALCboolean made = (alcMakeContextCurrent)(context);
+
+    trace_call("alcMakeContextCurrent", start,
+        made ? ALC_NO_ERROR : ALC_INVALID_CONTEXT, AL_TRUE,
+        (context != NULL), 0, 0, 0);
+    return (made);
+}
+void traced_alcDestroyContext(ALCcontext* context)
+{
+    TRACE_START;
+    register int i;
+
+    for (i = 0; i < TRACE_CONTEXTS; i++)
+        if (pending_errors[i].context == context)
+            pending_errors[i].error = AL_NO_ERROR; /* for the next one here */
+    (alcDestroyContext)(context);
+    trace_call("alcDestroyContext", start, ALC_NO_ERROR, AL_TRUE,
+        0, 0, 0, 0);
+}
+
+ALCboolean traced_alcSetThreadContext(ALCcontext* context)
+{
+    TRACE_START;
+    const ALCboolean made = (alcSetThreadContext)(context);
+
+    trace_call("alcSetThreadContext", start,
+        made ? ALC_NO_ERROR : ALC_INVALID_CONTEXT, AL_TRUE,
+        (context != NULL), 0, 0, 0);
+    return (made);
+}
+void traced_alcRenderSamplesSOFT(ALCdevice* device, ALCvoid* buffer,
+    ALCsizei frames)
+{
+    TRACE_START;
+    (alcRenderSamplesSOFT)(device, buffer, frames);
+    trace_call("alcRenderSamplesSOFT", start, alcGetError(device), AL_TRUE,
+        frames, 0, 0, 0);
+}
+
+#define alGetError()                    traced_alGetError()
+#define alSourcef(s, p, v)              traced_alSourcef(s, p, v)
+#define alSourcei(s, p, v)              traced_alSourcei(s, p, v)
+#define alSource3f(s, p, x, y, z)       traced_alSource3f(s, p, x, y, z)
+#define alSourcefv(s, p, v)             traced_alSourcefv(s, p, v)
+#define alGetSourcei(s, p, v)           traced_alGetSourcei(s, p, v)
+#define alListenerf(p, v)               traced_alListenerf(p, v)
+#define alListener3f(p, x, y, z)        traced_alListener3f(p, x, y, z)
+#define alListenerfv(p, v)              traced_alListenerfv(p, v)
+#define alSourcePlay(s)                 traced_alSourcePlay(s)
+#define alSourceStop(s)                 traced_alSourceStop(s)
+#define alSourcePause(s)                traced_alSourcePause(s)
+#define alSourceRewind(s)               traced_alSourceRewind(s)
+#define alSourcePlayv(n, s)             traced_alSourcePlayv(n, s)
+#define alSourceStopv(n, s)             traced_alSourceStopv(n, s)
+#define alSourceQueueBuffers(s, n, b)   traced_alSourceQueueBuffers(s, n, b)
+#define alSourceUnqueueBuffers(s, n, b) traced_alSourceUnqueueBuffers(s, n, b)
+#define alBufferData(b, f, d, s, r)     traced_alBufferData(b, f, d, s, r)
+#define alBufferi(b, p, v)              traced_alBufferi(b, p, v)
+#define alBufferCallbackSOFT(b, f, r, c, u) \
+    traced_alBufferCallbackSOFT(b, f, r, c, u)
+#define alGenBuffers(n, b)              traced_alGenBuffers(n, b)
+#define alDeleteBuffers(n, b)           traced_alDeleteBuffers(n, b)
+#define alGenSources(n, s)              traced_alGenSources(n, s)
+#define alDeleteSources(n, s)           traced_alDeleteSources(n, s)
+#define alcOpenDevice(n)                traced_alcOpenDevice(n)
+#define alcCloseDevice(d)               traced_alcCloseDevice(d)
+#define alcCreateContext(d, a)          traced_alcCreateContext(d, a)
+#define alcMakeContextCurrent(c)        traced_alcMakeContextCurrent(c)
+#define alcDestroyContext(c)            traced_alcDestroyContext(c)
+#define alcSetThreadContext(c)          traced_alcSetThreadContext(c)
+#define alcRenderSamplesSOFT(d, b, n)   traced_alcRenderSamplesSOFT(d, b, n)
+
+/*
+ * Write every thread's last calls, oldest first, to ALTRACE.TXT.
+ */
+void dump_AL_trace(void)
+{
+    FILE* out;
+    LONG count = trace_ring_count;
+    register LONG t;
+
+    out = fopen("ALTRACE.TXT", "w");
+    if (out == NULL)
+        return;
+    if (count > TRACE_THREADS)
+        count = TRACE_THREADS;
+    for (t = 0; t < count; t++)
+    {
+        const trace_ring* ring = trace_rings[t];
+        ALuint i;
+
+        if (ring == NULL)
+            continue; /* still being set up */
+        fprintf(out, "Thread %lu (%u calls):\n", ring->thread_id, ring->head);
+        i = (ring->head > TRACE_ENTRIES) ? ring->head - TRACE_ENTRIES : 0;
+        for (; i < ring->head; i++)
+        {
+            const trace_entry* entry = &ring->entries[i & (TRACE_ENTRIES-1)];
+
+            fprintf(out, "  %12.6f  %-24s(%g, %g, %g, %g)  %li us  %s\n",
+                ticks_to_seconds(entry->start - trace_epoch), entry->name,
+                entry->args[0], entry->args[1], entry->args[2],
+                entry->args[3], ticks_to_us(entry->ticks),
+                entry->ALC ? ALC_error_string(entry->error)
+                           : AL_error_string(entry->error));
+        }
+    }
+    fclose(out);
+    return;
+}
+#else
+#define dump_AL_trace()
+#endif
@@ -0,0 +1,153 @@
+/*
+ * Run-time tuning of a stream's queue:  how many buffers, and how big.
+ *
+ * queue_depth and buffer_frames are guesses that suit one machine under one
+ * load.  After every update_stream(), the controller notes how little was
+ * left queued just before the refill (the headroom), the longest gap
+ * between two refills (the jitter of the refill thread's wake-ups), the
+ * device latency from AL_SOFT_source_latency and any new underruns.  Once
+ * every TUNE_WINDOW milliseconds it acts on them:
+ *
+ *  - Underruns, or headroom below the worst gap plus the device latency,
+ *    grow the queue at once:  by one more buffer while any are spare, then
+ *    by half as many frames again in each.
+ *  - Headroom above twice that margin for TUNE_CALM windows running
+ *    shrinks it by one step:  buffer size first, then buffer count.
+ *
+ * Growing fast and shrinking slowly, at margins a factor of two apart,
+ * is the hysteresis keeping the controller from hunting back and forth.
+ */
+#define TUNE_WINDOW     500 /* milliseconds between decisions */
+#define TUNE_CALM       8 /* quiet windows before giving anything back */
+#define TUNE_MIN_MS     5 /* smallest buffer worth queuing */
+
+typedef struct {
+    LONGLONG window_start;
+    LONGLONG last_refill;
+    ALsizei min_headroom; /* fewest frames left queued this window, or -1 */
+    ALsizei max_gap; /* longest wait between refills, in frames */
+    ALsizei latency; /* device latency, in frames */
+    ALuint underruns; /* the stream's count at the start of the window */
+    ALuint calm; /* quiet windows in a row */
+    ALsizei min_chunk;
+
+    ALuint grows;
+    ALuint shrinks;
+} queue_tuner;
+
+void open_queue_tuner(queue_tuner* tuner, const AL_stream* stream)
+{
+    memset(tuner, 0, sizeof(queue_tuner));
+    tuner->window_start = ticks_now();
+    tuner->min_headroom = -1;
+    tuner->underruns = stream->underruns;
+    tuner->min_chunk = stream->frequency * TUNE_MIN_MS / 1000;
+    return;
+}
+
+void grow_queue(queue_tuner* tuner, AL_stream* stream)
+{
+    if (stream->active < stream->depth)
+        limit_stream(stream, stream->active + 1, stream->chunk);
+    else if (stream->chunk < stream->frames)
+        limit_stream(stream, stream->active,
+            stream->chunk + (stream->chunk + 1) / 2);
+    else
+        return; /* already at the allocated maximum */
+    ++tuner->grows;
+    return;
+}
+
+void shrink_queue(queue_tuner* tuner, AL_stream* stream)
+{
+    ALsizei chunk = stream->chunk - stream->chunk / 4;
+
+    if (chunk < tuner->min_chunk)
+        chunk = tuner->min_chunk;
+    if (chunk < stream->chunk)
+        limit_stream(stream, stream->active, chunk);
+    else if (stream->active > 2)
+        limit_stream(stream, stream->active - 1, stream->chunk);
+    else
+        return;
+    ++tuner->shrinks;
+    return;
+}
+
+/*
+ * Call from the refill thread after each update_stream(), passing what it
+ * returned.  `events` gets its poll interval matched to the buffer size.
+ */
+void adapt_queue(queue_tuner* tuner, AL_stream* stream,
+    stream_events* events, ALint refilled)
+{
+    const LONGLONG now = ticks_now();
+    ALint queued, offset;
+    ALint64SOFT latency;
+    ALsizei headroom, margin;
+
+    if (stream->pull)
+        return; /* no queue to tune */
+    if (!stream->playing)
+    { /* Paused or stopped:  no gap to measure, and a fresh window after. */
+        tuner->last_refill = 0;
+        tuner->window_start = now;
+        tuner->min_headroom = -1;
+        tuner->max_gap = 0;
+        tuner->underruns = stream->underruns;
+        return;
+    }
+    if (refilled > 0)
+    {
+        const ALsizei gap = (ALsizei)(ticks_to_seconds(
+            now - tuner->last_refill) * stream->frequency);
+
+        if (tuner->last_refill != 0 && gap > tuner->max_gap)
+            tuner->max_gap = gap;
+        tuner->last_refill = now;
+    }
+    alGetSourcei(stream->source, AL_BUFFERS_QUEUED, &queued);
+    get_source_latency(stream->source, &offset, &latency);
+    headroom = (queued - refilled) * stream->chunk - offset;
+    if (tuner->min_headroom < 0 || headroom < tuner->min_headroom)
+        tuner->min_headroom = (headroom > 0) ? headroom : 0;
+    tuner->latency = (ALsizei)(latency * stream->frequency / 1000000000);
+
+    if (ticks_to_us(now - tuner->window_start) < TUNE_WINDOW * 1000)
+        return;
+    margin = tuner->max_gap + tuner->latency;
+    if (stream->underruns != tuner->underruns
+     || tuner->min_headroom < margin)
+    {
+        grow_queue(tuner, stream);
+        tuner->calm = 0;
+    }
+    else if (tuner->min_headroom > 2*margin + stream->chunk)
+    {
+        if (++tuner->calm >= TUNE_CALM)
+        {
+            shrink_queue(tuner, stream);
+            tuner->calm = 0;
+        }
+    }
+    else
+        tuner->calm = 0;
+    events->max_interval = 1000 * stream->chunk / stream->frequency / 2;
+    if (events->max_interval == 0)
+        events->max_interval = 1;
+
+    tuner->window_start = now;
+    tuner->min_headroom = -1;
+    tuner->max_gap = 0;
+    tuner->underruns = stream->underruns;
+    return;
+}
+
+void log_queue_tuner(const queue_tuner* tuner, const AL_stream* stream)
+{
+    printf("Queue tuning:  %u grows, %u shrinks; settled on %i buffers "
+        "of %i frames (%i ms queued)\n", tuner->grows, tuner->shrinks,
+        stream->active, stream->chunk,
+        (int)(1000.0 * stream->active * stream->chunk / stream->frequency));
+    return;
+}
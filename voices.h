@@ -0,0 +1,259 @@
+/*
+ * Pool of pre-generated AL sources ("voices") for one-shot sound effects.
+ *
+ * All the sources come from a single alGenSources call at start-up, so
+ * firing a sound never costs an alGenSources/alDeleteSources round trip, and
+ * the mixer never sees more than `count` voices at once.  Free voices sit on
+ * a stack, so taking one is O(1).
+ *
+ * Finished voices (AL_STOPPED) go back on the stack by update_voice_pool().
+ * When every voice is busy, the lowest-priority voice is stolen, the
+ * quietest one among equals, provided it does not outrank the newcomer.
+ *
+ * Callers hold voice handles rather than source names:  each reuse of a
+ * voice bumps its serial number, so a stale handle to a stolen voice is
+ * harmlessly refused instead of stopping somebody else's sound.
+ *
+ * A voice may also hold whatever owns its buffer (a cached sound, say),
+ * handed to `release` once the voice is reclaimed, stolen or closed and the
+ * buffer is off the source.
+ */
+#define MAX_VOICES      256
+
+typedef ALuint voice_handle; /* 0 is never a valid handle */
+typedef void (*voice_release)(ALvoid* user, ALvoid* held);
+
+typedef struct {
+    ALuint sources[MAX_VOICES];
+    ALsizei count;
+
+    ALint priority[MAX_VOICES];
+    ALfloat gain[MAX_VOICES];
+    ALuint serial[MAX_VOICES];
+    ALvoid* held[MAX_VOICES]; /* NULL unless played with a holder */
+    voice_release release;
+    ALvoid* release_user;
+
+    ALsizei free_list[MAX_VOICES]; /* stack of idle voice indices */
+    ALsizei free_count;
+    ALsizei busy[MAX_VOICES]; /* unordered list of playing voice indices */
+    ALsizei busy_count;
+    ALsizei busy_slot[MAX_VOICES]; /* where each voice sits in `busy` */
+
+    ALuint plays;
+    ALuint steals;
+    ALuint refusals; /* plays dropped because everything outranked them */
+} voice_pool;
+
+ALboolean open_voice_pool(voice_pool* pool, ALsizei count)
+{
+    ALenum ALstatus;
+    register ALsizei i;
+
+    memset(pool, 0, sizeof(voice_pool));
+    if (count <= 0 || count > MAX_VOICES)
+    {
+        printf("Voice pool must hold 1 to %i voices.\n", MAX_VOICES);
+        return AL_FALSE;
+    }
+    alGetError();
+    alGenSources(count, pool->sources);
+    ALstatus = alGetError();
+    if (ALstatus != AL_NO_ERROR)
+    {
+        printf("Driver refused %i voices (0x%04X).\n", count, ALstatus);
+        return AL_FALSE;
+    }
+    pool->count = count;
+    for (i = 0; i < count; i++)
+    {
+        setup_source(pool->sources[i]);
+        pool->serial[i] = 1;
+        pool->free_list[pool->free_count++] = count - 1 - i;
+    }
+    return AL_TRUE;
+}
+
+void close_voice_pool(voice_pool* pool)
+{
+    register ALsizei i;
+
+    alSourceStopv(pool->count, pool->sources);
+    alDeleteSources(pool->count, pool->sources);
+    for (i = 0; i < pool->count; i++)
+        if (pool->held[i] != NULL)
+        {
+            pool->release(pool->release_user, pool->held[i]);
+            pool->held[i] = NULL;
+        }
+    pool->count = pool->free_count = pool->busy_count = 0;
+    return;
+}
+
+ALsizei voice_index(const voice_pool* pool, voice_handle voice)
+{
+    const ALsizei index = (ALsizei)(voice & 0xFFFF);
+
+    if (voice == 0 || index >= pool->count)
+        return -1;
+    if (pool->serial[index] != (voice >> 16)) /* since reused */
+        return -1;
+    return (index);
+}
+
+/*
+ * the AL source name behind a handle, or 0 if the voice has moved on
+ */
+ALuint voice_source(const voice_pool* pool, voice_handle voice)
+{
+    const ALsizei index = voice_index(pool, voice);
+
+    return (index < 0) ? 0 : pool->sources[index];
+}
+
+void release_voice_index(voice_pool* pool, ALsizei index)
+{
+    const ALsizei slot = pool->busy_slot[index];
+    const ALsizei last = pool->busy[--pool->busy_count];
+
+    pool->busy[slot] = last; /* O(1) unordered removal */
+    pool->busy_slot[last] = slot;
+    alSourcei(pool->sources[index], AL_BUFFER, AL_NONE);
+    if (pool->held[index] != NULL)
+    {
+        pool->release(pool->release_user, pool->held[index]);
+        pool->held[index] = NULL;
+    }
+    pool->serial[index] = (pool->serial[index] + 1) & 0xFFFF;
+    if (pool->serial[index] == 0)
+        pool->serial[index] = 1;
+    pool->free_list[pool->free_count++] = index;
+    return;
+}
+
+void stop_voice(voice_pool* pool, voice_handle voice)
+{
+    const ALsizei index = voice_index(pool, voice);
+
+    if (index < 0)
+        return;
+    alSourceStop(pool->sources[index]);
+    release_voice_index(pool, index);
+    return;
+}
+
+/*
+ * Return every voice that has played to the end to the free stack.
+ * Returns the count of voices reclaimed.
+ */
+ALsizei update_voice_pool(voice_pool* pool)
+{
+    ALsizei reclaimed = 0;
+    register ALsizei i;
+
+    for (i = pool->busy_count - 1; i >= 0; i--)
+    {
+        const ALsizei index = pool->busy[i];
+        ALint state;
+
+        alGetSourcei(pool->sources[index], AL_SOURCE_STATE, &state);
+        if (state == AL_STOPPED)
+        {
+            release_voice_index(pool, index);
+            ++reclaimed;
+        }
+    }
+    return (reclaimed);
+}
+
+/*
+ * Pick the voice to steal:  lowest priority first, then lowest gain.
+ * Returns -1 if every busy voice outranks `priority`.
+ */
+ALsizei pick_victim(const voice_pool* pool, ALint priority)
+{
+    ALsizei victim = -1;
+    register ALsizei i;
+
+    for (i = 0; i < pool->busy_count; i++)
+    {
+        const ALsizei index = pool->busy[i];
+
+        if (pool->priority[index] > priority)
+            continue;
+        if (victim < 0
+         || pool->priority[index] < pool->priority[victim]
+         || (pool->priority[index] == pool->priority[victim]
+          && pool->gain[index] < pool->gain[victim]))
+            victim = index;
+    }
+    return (victim);
+}
+
+/*
+ * Take a free voice for `buf`, stealing one if need be, the voice holding
+ * `held` (if not NULL) until it is let go.  The source is left unstarted, so
+ * the caller can set it up before alSourcePlay().  Returns 0 if no voice
+ * could be had at this priority; `held` is then still the caller's.
+ */
+voice_handle claim_voice(voice_pool* pool, ALuint buf, ALfloat gain,
+    ALint priority, ALvoid* held)
+{
+    ALsizei index;
+    ALuint src;
+
+    if (pool->free_count == 0)
+        update_voice_pool(pool);
+    if (pool->free_count == 0)
+    {
+        index = pick_victim(pool, priority);
+        if (index < 0)
+        {
+            ++pool->refusals;
+            return 0;
+        }
+        alSourceStop(pool->sources[index]);
+        release_voice_index(pool, index);
+        ++pool->steals;
+    }
+
+    index = pool->free_list[--pool->free_count];
+    pool->busy_slot[index] = pool->busy_count;
+    pool->busy[pool->busy_count++] = index;
+    pool->priority[index] = priority;
+    pool->gain[index] = gain;
+    pool->held[index] = held;
+
+    src = pool->sources[index];
+    alSourcei(src, AL_BUFFER, buf);
+    alSourcef(src, AL_GAIN, gain);
+    ++pool->plays;
+    return (pool->serial[index] << 16) | (voice_handle)index;
+}
+
+/*
+ * Start `buf` playing once on a voice from claim_voice().
+ */
+voice_handle play_held_voice(voice_pool* pool, ALuint buf, ALfloat gain,
+    ALint priority, ALvoid* held)
+{
+    const voice_handle voice = claim_voice(pool, buf, gain, priority, held);
+
+    if (voice != 0)
+        alSourcePlay(voice_source(pool, voice));
+    return (voice);
+}
+
+voice_handle play_voice(
+    voice_pool* pool, ALuint buf, ALfloat gain, ALint priority)
+{
+    return play_held_voice(pool, buf, gain, priority, NULL);
+}
+
+void log_voice_pool(const voice_pool* pool)
+{
+    printf("Voice pool:  %i of %i busy, %u plays, %u steals, %u refused\n",
+        pool->busy_count, pool->count, pool->plays, pool->steals,
+        pool->refusals);
+    return;
+}
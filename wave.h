@@ -0,0 +1,237 @@
+/*
+ * Native RIFF/WAVE loader over a read-only memory mapping of the file.
+ *
+ * alutLoadWAVFile read the whole file into a heap copy, and alBufferData
+ * then made a second copy of it.  Mapping the file lets the PCM chunk go
+ * straight from the page cache to alBufferData (or to the streaming queue a
+ * buffer at a time), with no allocation of our own in between.  IMA and
+ * Microsoft ADPCM files load too; adpcm.h decides whether they go to AL
+ * still compressed or get decoded first.
+ */
+typedef struct {
+    HANDLE file;
+    HANDLE mapping;
+    const ALubyte* view; /* the whole file, mapped read-only */
+    ALsizei view_size;
+
+    ALushort format_tag; /* 1 for integer PCM */
+    ALushort channels;
+    ALushort bits;
+    ALushort block_align; /* bytes per sample frame, or per ADPCM block */
+    ALsizei frequency;
+    ALenum format; /* the matching AL_FORMAT_*, or AL_NONE if unsupported */
+    ALenum pcm_format; /* what `format` decodes to; the same for PCM */
+
+    ALsizei block_frames; /* sample frames per block:  1 for PCM */
+    const ALubyte* extra; /* "fmt " bytes past cbSize (ADPCM coefficients) */
+    ALsizei extra_size;
+
+    const ALubyte* data; /* "data" chunk payload inside `view` */
+    ALsizei size; /* in bytes, whole blocks only */
+    ALsizei frames; /* sample frames in `data`, once decoded */
+} wave_file;
+
+#define WAVE_FORMAT_PCM         0x0001
+#define WAVE_FORMAT_ADPCM       0x0002 /* Microsoft ADPCM */
+#define WAVE_FORMAT_IMA_ADPCM   0x0011
+#define WAVE_FORMAT_EXTENSIBLE  0xFFFE
+
+/*
+ * Whether `block_frames` sample frames can come out of an ADPCM block of
+ * `block_align` bytes.  IMA4 keeps one sample in its 4-byte channel header
+ * and packs the rest 8 to a 4-byte word; MS ADPCM keeps two in its 7-byte
+ * header and packs the rest two to a byte.
+ */
+ALboolean adpcm_block_fits(ALenum format, ALsizei channels,
+    ALsizei block_align, ALsizei block_frames)
+{
+    if (format == AL_FORMAT_MONO_IMA4 || format == AL_FORMAT_STEREO_IMA4)
+        return (block_frames - 1) % 8 == 0
+            && 4*channels + (block_frames - 1) / 2 * channels <= block_align;
+    return block_frames >= 2
+        && 7*channels + ((block_frames - 2) * channels + 1) / 2 <= block_align;
+}
+
+/*
+ * RIFF is little-endian no matter the host, so read fields a byte at a time.
+ */
+ALuint read_LE32(const ALubyte* p)
+{
+    return (p[0] << 0) | (p[1] << 8) | (p[2] << 16) | ((ALuint)p[3] << 24);
+}
+ALushort read_LE16(const ALubyte* p)
+{
+    return (ALushort)((p[0] << 0) | (p[1] << 8));
+}
+
+ALenum wave_AL_format(const wave_file* wave)
+{
+    if (wave->format_tag == WAVE_FORMAT_IMA_ADPCM && wave->bits == 4)
+        return (wave->channels == 1) ? AL_FORMAT_MONO_IMA4
+             : (wave->channels == 2) ? AL_FORMAT_STEREO_IMA4 : AL_NONE;
+    if (wave->format_tag == WAVE_FORMAT_ADPCM && wave->bits == 4)
+        return (wave->channels == 1) ? AL_FORMAT_MONO_MSADPCM_SOFT
+             : (wave->channels == 2) ? AL_FORMAT_STEREO_MSADPCM_SOFT : AL_NONE;
+    if (wave->format_tag != WAVE_FORMAT_PCM)
+        return AL_NONE;
+    if (wave->channels == 1 && wave->bits == 8)
+        return AL_FORMAT_MONO8;
+    if (wave->channels == 1 && wave->bits == 16)
+        return AL_FORMAT_MONO16;
+    if (wave->channels == 2 && wave->bits == 8)
+        return AL_FORMAT_STEREO8;
+    if (wave->channels == 2 && wave->bits == 16)
+        return AL_FORMAT_STEREO16;
+    return AL_NONE;
+}
+
+/*
+ * Walk the chunk list for "fmt " and "data", checking that every chunk
+ * header and payload lies inside the file before anything dereferences it.
+ */
+ALboolean parse_wave(wave_file* wave)
+{
+    const ALubyte* fmt = NULL;
+    ALuint fmt_size = 0;
+    ALuint offset;
+
+    if (wave->view_size < 12
+     || memcmp(wave->view + 0, "RIFF", 4) != 0
+     || memcmp(wave->view + 8, "WAVE", 4) != 0)
+    {
+        printf("Not a RIFF/WAVE file.\n");
+        return AL_FALSE;
+    }
+    for (offset = 12; offset + 8 <= (ALuint)wave->view_size; )
+    {
+        const ALubyte* chunk = wave->view + offset;
+        const ALuint size = read_LE32(chunk + 4);
+
+        if (size > (ALuint)wave->view_size - offset - 8)
+        {
+            printf("WAVE chunk \"%.4s\" runs past the end of file.\n", chunk);
+            return AL_FALSE;
+        }
+        if (memcmp(chunk, "fmt ", 4) == 0)
+        {
+            fmt = chunk + 8;
+            fmt_size = size;
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            wave->data = chunk + 8;
+            wave->size = (ALsizei)size;
+        }
+        offset += 8 + size + (size & 1); /* Chunks are padded to even sizes. */
+    }
+
+    if (fmt == NULL || fmt_size < 16)
+    {
+        printf("WAVE file has no usable \"fmt \" chunk.\n");
+        return AL_FALSE;
+    }
+    if (wave->data == NULL)
+    {
+        printf("WAVE file has no \"data\" chunk.\n");
+        return AL_FALSE;
+    }
+    wave->format_tag  = read_LE16(fmt + 0);
+    wave->channels    = read_LE16(fmt + 2);
+    wave->frequency   = (ALsizei)read_LE32(fmt + 4);
+    wave->block_align = read_LE16(fmt + 12);
+    wave->bits        = read_LE16(fmt + 14);
+
+/*
+ * WAVE_FORMAT_EXTENSIBLE keeps the real format tag as the first two bytes
+ * of the sub-format GUID, 24 bytes into the extension.
+ */
+    if (wave->format_tag == WAVE_FORMAT_EXTENSIBLE && fmt_size >= 40)
+        wave->format_tag = read_LE16(fmt + 24);
+
+/*
+ * ADPCM blocks state their length in sample frames (wSamplesPerBlock) as
+ * the first two bytes past cbSize; MS ADPCM follows with its coefficients.
+ */
+    wave->format = wave_AL_format(wave);
+    wave->pcm_format = wave->format;
+    wave->block_frames = 1;
+    if (wave->format != AL_NONE && wave->bits == 4)
+    {
+        if (fmt_size < 20 || read_LE16(fmt + 16) < 2)
+        {
+            printf("ADPCM \"fmt \" chunk is missing wSamplesPerBlock.\n");
+            return AL_FALSE;
+        }
+        wave->block_frames = read_LE16(fmt + 18);
+        wave->extra = fmt + 20;
+        wave->extra_size = (ALsizei)fmt_size - 20;
+        wave->pcm_format = (wave->channels == 1)
+            ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+        if (wave->block_frames == 0
+         || !adpcm_block_fits(wave->format, wave->channels,
+                wave->block_align, wave->block_frames))
+        {
+            printf("ADPCM blocks of %i bytes cannot hold %i frames.\n",
+                wave->block_align, wave->block_frames);
+            return AL_FALSE;
+        }
+    }
+    if (wave->block_align != 0)
+        wave->size -= wave->size % wave->block_align; /* whole blocks only */
+    wave->frames = (wave->block_align == 0) ? 0
+        : wave->size / wave->block_align * wave->block_frames;
+    return AL_TRUE;
+}
+
+void close_wave(wave_file* wave)
+{
+    if (wave->view != NULL)
+        UnmapViewOfFile(wave->view);
+    if (wave->mapping != NULL)
+        CloseHandle(wave->mapping);
+    if (wave->file != INVALID_HANDLE_VALUE)
+        CloseHandle(wave->file);
+    wave->view = NULL;
+    wave->mapping = NULL;
+    wave->file = INVALID_HANDLE_VALUE;
+    return;
+}
+
+ALboolean open_wave(wave_file* wave, const char* path)
+{
+    LARGE_INTEGER size;
+
+    memset(wave, 0, sizeof(wave_file));
+    wave->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (wave->file == INVALID_HANDLE_VALUE)
+    {
+        printf("Unable to open \"%s\".\n", path);
+        return AL_FALSE;
+    }
+    if (GetFileSizeEx(wave->file, &size) == 0
+     || size.QuadPart < 12 || size.QuadPart > 0x7FFFFFFF)
+    {
+        printf("\"%s\" is too small or too large to map.\n", path);
+        close_wave(wave);
+        return AL_FALSE;
+    }
+    wave->view_size = (ALsizei)size.QuadPart;
+    wave->mapping = CreateFileMapping(wave->file, NULL, PAGE_READONLY,
+        0, 0, NULL);
+    if (wave->mapping != NULL)
+        wave->view = (const ALubyte *)MapViewOfFile(wave->mapping,
+            FILE_MAP_READ, 0, 0, 0);
+    if (wave->view == NULL)
+    {
+        printf("Failed to map \"%s\" into memory.\n", path);
+        close_wave(wave);
+        return AL_FALSE;
+    }
+    if (parse_wave(wave) == AL_FALSE)
+    {
+        close_wave(wave);
+        return AL_FALSE;
+    }
+    return AL_TRUE;
+}